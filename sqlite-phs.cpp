@@ -1,194 +1,3657 @@
 #define PHASOR_FFI_BUILD_DLL
 #include <PhasorFFI.hpp>
 #include "sqlite/sqlite3.h"
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <list>
+#include <random>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
+#include <condition_variable>
+#include <functional>
 #include <mutex>
+#include <thread>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
 
-static std::unordered_map<int, sqlite3*> db_table;
-static std::unordered_map<int, sqlite3_stmt*> stmt_table;
-static std::unordered_map<int, char*> string_table;
-static int next_db_handle = 1;
-static int next_stmt_handle = 1;
-static int next_string_handle = 1;
-static std::mutex db_mutex;
-static std::mutex stmt_mutex;
-static std::mutex string_mutex;
+static const size_t default_cache_capacity = 64;
+
+// Bounded LRU of idle prepared statements keyed by their SQL text.
+// Statements are removed while checked out, so a cached statement is never shared.
+struct StatementCache {
+    size_t capacity = default_cache_capacity;
+    std::list<std::pair<std::string, sqlite3_stmt*>> entries; // most recently used first
+    std::unordered_map<std::string, std::list<std::pair<std::string, sqlite3_stmt*>>::iterator> index;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+};
+
+// Implicit transaction opened by sqlite_autobatch and committed after enough writes or time.
+struct AutoBatch {
+    std::mutex mutex;
+    bool enabled = false;
+    int64_t max_writes = 0; // 0 means no write limit
+    int64_t max_ms = 0;     // 0 means no time limit
+    bool open = false;      // the current transaction was opened by the batcher
+    int64_t writes = 0;
+    std::chrono::steady_clock::time_point opened;
+    std::condition_variable wake; // a batch was opened or the timer is stopping
+    bool stop = false;
+    std::thread timer; // commits batches that reach max_ms; serialized connections only
+};
+
+// One unit of work for the write queue. `run` executes on the writer thread inside a
+// savepoint of the group transaction and returns SQLITE_OK or the error that undid it.
+struct WriteJob {
+    std::function<int()> run;
+    bool wait_commit = true; // the caller waits for the group commit, not just for `run`
+    bool detached = false;   // fire-and-forget; the writer deletes the job after running it
+    bool isolated = false;   // has a deadline, so it runs outside the shared group transaction
+    bool executed = false;
+    bool settled = false;    // group committed or rolled back; only set when wait_commit
+    int rc = SQLITE_OK;
+};
+
+// Group-commit queue enabled by sqlite_write_queue. A single writer thread drains every
+// pending job into one transaction, so concurrent writers share one commit and one fsync.
+struct WriteQueue {
+    std::mutex mutex;
+    std::condition_variable wake;     // writer: jobs pending or stopping
+    std::condition_variable finished; // callers: jobs executed or settled
+    std::deque<WriteJob*> pending;
+    bool running = false;
+    bool stop = false;
+    bool wait_commit = true; // default durability for calls that do not choose one
+    std::thread thread;
+    uint64_t groups = 0;
+    uint64_t jobs = 0;
+    uint64_t failures = 0;
+};
+
+// Background checkpointer enabled by sqlite_checkpointer_start. The writer's WAL hook only
+// records the WAL size; checkpoints run on this thread through a connection of its own, so no
+// commit pays for one.
+struct Checkpointer {
+    std::mutex mutex;
+    std::condition_variable wake;
+    sqlite3* db = nullptr; // used only by the thread
+    bool running = false;
+    bool stop = false;
+    int pages = 0;          // WAL size in pages after the latest commit; 0 once handled
+    int passive_pages = 1000;
+    int restart_pages = 4000;
+    int truncate_pages = 16000;
+    int autocheckpoint = 0; // inline threshold restored on stop
+    int escalate_pages = 0; // WAL size to reach before escalating again after SQLITE_BUSY
+    std::thread thread;
+    uint64_t passive = 0;
+    uint64_t restarts = 0;
+    uint64_t truncates = 0;
+    uint64_t busy = 0;
+};
+
+// Lock-contention policy set by sqlite_busy_backoff and sqlite_busy_retry, with counters for
+// sqlite_busy_stats. A pool keeps one policy on its writer that its readers share.
+struct BusyPolicy {
+    std::atomic<int64_t> total_ms{0};   // backoff handler budget per wait
+    std::atomic<int64_t> initial_ms{1}; // first backoff delay, doubled on every retry
+    std::atomic<int64_t> max_ms{100};   // cap on a single delay
+    std::atomic<int> retries{0};        // automatic re-runs of a call that still got BUSY/LOCKED
+    std::atomic<uint64_t> waits{0};
+    std::atomic<uint64_t> retried{0};
+    std::atomic<uint64_t> failures{0};
+};
+
+struct Connection {
+    sqlite3* db = nullptr;
+    std::mutex cache_mutex;
+    StatementCache cache;
+    AutoBatch batch;
+    WriteQueue queue;
+    Checkpointer checkpointer;
+    std::atomic<int64_t> timeout_ms{0}; // per-call limit from sqlite_set_timeout; 0 for none
+    BusyPolicy busy;
+
+    // Read-only connections of a pool opened by sqlite_pool_open; empty for plain connections.
+    // The vector is fixed once the pool is registered, so it is read without locking.
+    std::vector<Connection*> readers;
+    std::atomic<int> active{0}; // statements currently checked out of this reader
+};
+
+// One decoded row in a prefetch ring. Both vectors keep their capacity, so a warmed-up ring
+// decodes rows without allocating.
+struct PrefetchRow {
+    std::vector<PhasorValue> values;
+    std::vector<char> text;
+    std::vector<PhasorValue> bytes; // BLOB contents, one int per byte
+};
+
+// Single-producer/single-consumer ring filled by a background thread that steps a read-only
+// statement ahead of the script. `head` counts rows produced and `tail` rows the consumer has
+// released; the row at `tail` stays untouched while the consumer is reading it.
+struct Prefetcher {
+    std::vector<PrefetchRow> ring;
+    std::atomic<uint64_t> head{0};
+    std::atomic<uint64_t> tail{0};
+    std::atomic<bool> stop{false};
+    std::atomic<bool> finished{false};
+    int result = SQLITE_DONE; // final sqlite3_step result, published by `finished`
+    bool timed_out = false;   // `result` is an interrupt caused by the timeout, likewise
+    int64_t timeout_ms = 0;   // limit for each step of the producer
+    bool holding = false;     // the consumer is reading ring[tail % size]
+    // A side that finds the ring full or empty for longer than a short spin sleeps here until
+    // the other side moves `head`, `tail`, `stop` or `finished`.
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::atomic<int> sleepers{0};
+    std::thread thread;
+};
+
+struct Statement {
+    sqlite3_stmt* stmt = nullptr;
+    int db_handle = 0;
+    int reader = -1; // index into the pool's readers, or -1 when prepared on the writer
+    std::string sql;
+    bool readonly = true;
+    bool begins_transaction = false;
+    bool controls_transaction = false; // BEGIN, COMMIT, SAVEPOINT and friends
+    bool aborted = false;   // interrupted; further steps fail until the statement is reset
+    bool timed_out = false; // the interrupt came from the sqlite_set_timeout deadline
+    std::vector<PhasorValue> row; // backing storage for arrays returned by sqlite_next_row
+    std::vector<PhasorValue> row_bytes;    // BLOB contents for `row`
+    std::vector<PhasorValue> column_bytes; // BLOB contents for the last sqlite_column result
+    std::vector<int> views; // buffer handles viewing the current row, see sqlite_column_blob
+
+    // Column-major arena for sqlite_fetch_many, reused by every batch. Columns grow with the
+    // rows actually stepped, never to the requested maximum up front.
+    std::vector<std::vector<PhasorValue>> batch_cells;
+    std::vector<PhasorValue> batch_columns;
+    std::vector<char> batch_text;
+    std::vector<PhasorValue> batch_bytes;
+    bool batch_done = false; // last batch hit SQLITE_DONE; the next call reports the end
+
+    size_t prefetch_depth = 0;         // ring size requested at prepare time; 0 disables prefetch
+    Prefetcher* prefetch = nullptr;    // running producer, if any
+};
+
+// Generational slot map behind the integer handles given to scripts.
+// A handle packs a slot index (low bits) with the slot's generation (high bits), so lookups
+// are a plain array index with no hashing or locking, and a handle whose slot has since been
+// freed or reused is rejected. Slots live in fixed-size chunks that never move once allocated,
+// which is what makes the lock-free read path safe while other threads insert.
+template <typename T>
+class HandleTable {
+public:
+    // The lookup itself is safe against concurrent inserts and removals, but the pointer it
+    // returns is only usable while no other thread can remove and delete the value. Callers
+    // therefore look handles up and remove them only from the thread running the script, which
+    // serializes both; background threads are handed the object itself. The one exception is
+    // the worker running a *_async call, which is covered by the rule that the script does not
+    // close or finalize a handle while an async call on it is pending.
+    T* get(int handle) const {
+        if (handle <= 0) return nullptr;
+        uint32_t index = (uint32_t)handle & index_mask;
+        uint32_t generation = (uint32_t)handle >> index_bits;
+        Slot* chunk = chunks[index / chunk_size].load(std::memory_order_acquire);
+        if (!chunk) return nullptr;
+
+        Slot& slot = chunk[index % chunk_size];
+        if (slot.generation.load(std::memory_order_acquire) != generation) return nullptr;
+        T* value = slot.value.load(std::memory_order_acquire);
+        // Re-check in case the slot was released and reused while the value was being read.
+        if (slot.generation.load(std::memory_order_acquire) != generation) return nullptr;
+        return value;
+    }
+
+    // Returns 0 when every slot is in use.
+    int insert(T* value) {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        uint32_t index;
+        if (!free_slots.empty()) {
+            // Reuse the longest-freed slot first so generations wrap as late as possible.
+            index = free_slots.front();
+            free_slots.pop_front();
+        } else {
+            if (used == max_slots) return 0;
+            index = used++;
+            if (index % chunk_size == 0)
+                chunks[index / chunk_size].store(new Slot[chunk_size], std::memory_order_release);
+        }
+
+        Slot& slot = slot_at(index);
+        slot.value.store(value, std::memory_order_release);
+        return (int)((slot.generation.load(std::memory_order_relaxed) << index_bits) | index);
+    }
+
+    // Detaches and returns the value, or nullptr if the handle is stale or unknown.
+    T* remove(int handle) {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        T* value = get(handle);
+        if (!value) return nullptr;
+
+        uint32_t index = (uint32_t)handle & index_mask;
+        Slot& slot = slot_at(index);
+        slot.value.store(nullptr, std::memory_order_release);
+        uint32_t generation = slot.generation.load(std::memory_order_relaxed);
+        slot.generation.store(generation == generation_mask ? 1 : generation + 1, std::memory_order_release);
+        free_slots.push_back(index);
+        return value;
+    }
+
+private:
+    // 15 index bits and 16 generation bits keep every handle a positive int: up to 32768 live
+    // handles per table, and a stale handle is only accepted again once its slot has been
+    // reused 65535 times.
+    static const uint32_t index_bits = 15;
+    static const uint32_t index_mask = (1u << index_bits) - 1;
+    static const uint32_t generation_mask = (1u << (31 - index_bits)) - 1;
+    static const uint32_t max_slots = 1u << index_bits;
+    static const uint32_t chunk_size = 1024;
+
+    struct Slot {
+        std::atomic<uint32_t> generation{1}; // never 0, so no handle is 0
+        std::atomic<T*> value{nullptr};
+    };
+
+    Slot& slot_at(uint32_t index) {
+        return chunks[index / chunk_size].load(std::memory_order_relaxed)[index % chunk_size];
+    }
+
+    // Chunks are never freed: a lookup may still be reading one during shutdown.
+    std::atomic<Slot*> chunks[max_slots / chunk_size] = {};
+    std::mutex write_mutex;
+    std::deque<uint32_t> free_slots;
+    uint32_t used = 0;
+};
+
+// Result slot of an operation queued by one of the *_async functions. Results are always
+// scalars (bool, int, null or a string literal), so they can be handed back long after the
+// work finished.
+struct Future {
+    std::mutex mutex;
+    std::condition_variable finished;
+    bool done = false;
+    PhasorValue result = phasor_make_null();
+};
+
+// Bytes behind a buffer handle. A view points straight into a statement's current row and is
+// released when the statement moves on; an owned buffer keeps its bytes in `owned`.
+struct Buffer {
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+    std::vector<unsigned char> owned;
+};
+
+// Open incremental BLOB I/O handle from sqlite_blob_open.
+struct Blob {
+    sqlite3_blob* blob = nullptr;
+    bool writable = false;
+};
+
+// Online backup from sqlite_backup_start. Steps are serialized by `mutex`, since the script and
+// the pacing thread of sqlite_backup_background may both drive the same backup.
+struct Backup {
+    sqlite3* dest = nullptr;
+    sqlite3_backup* backup = nullptr;
+    std::mutex mutex;
+    int rc = SQLITE_OK; // result of the last step
+    std::atomic<int> remaining{0};
+    std::atomic<int> pagecount{0};
+    bool source_serialized = true; // the source may be stepped from another thread
+
+    std::thread thread; // pacing thread, if started
+    bool stop = false;  // guarded by `mutex`
+    std::condition_variable wake;
+};
+
+static HandleTable<Connection> db_table;
+static HandleTable<Statement> stmt_table;
+static HandleTable<Future> future_table;
+static HandleTable<Buffer> buffer_table;
+static HandleTable<Blob> blob_table;
+static HandleTable<Backup> backup_table;
+
+Connection* get_connection(int handle) {
+    return db_table.get(handle);
+}
 
 sqlite3* get_db(int handle) {
-    std::lock_guard<std::mutex> lock(db_mutex);
-    auto it = db_table.find(handle);
-    return it != db_table.end() ? it->second : nullptr;
+    Connection* conn = get_connection(handle);
+    return conn ? conn->db : nullptr;
+}
+
+Statement* get_statement(int handle) {
+    return stmt_table.get(handle);
+}
+
+// Frees the buffer handles that view the statement's current row.
+void release_views(Statement* statement) {
+    for (int handle : statement->views) delete buffer_table.remove(handle);
+    statement->views.clear();
+}
+
+void stop_prefetch(Statement* statement);
+
+// Returns the raw statement for binding, or nullptr while a prefetching scan is in progress.
+// The producer has already stepped SQLite past the rows it buffered, so the scan can neither be
+// rebound in place nor stopped without losing them; it has to be reset first, as SQLite itself
+// requires for binding a statement that is running.
+sqlite3_stmt* get_stmt(int handle) {
+    Statement* statement = get_statement(handle);
+    if (!statement || statement->prefetch) return nullptr;
+    return statement->stmt;
+}
+
+// Removes and returns the idle cached statement for `sql`, or nullptr. Called with cache_mutex held.
+sqlite3_stmt* take_cached(StatementCache& cache, const char* sql) {
+    auto it = cache.index.find(sql);
+    if (it == cache.index.end()) return nullptr;
+    sqlite3_stmt* stmt = it->second->second;
+    cache.entries.erase(it->second);
+    cache.index.erase(it);
+    cache.hits++;
+    return stmt;
+}
+
+// Returns an idle cached statement for `sql`, or compiles a new one on a miss.
+sqlite3_stmt* acquire_statement(Connection* conn, const char* sql) {
+    bool persistent;
+    {
+        std::lock_guard<std::mutex> lock(conn->cache_mutex);
+        StatementCache& cache = conn->cache;
+        if (cache.capacity > 0) {
+            sqlite3_stmt* stmt = take_cached(cache, sql);
+            if (stmt) return stmt;
+            cache.misses++;
+        }
+        persistent = cache.capacity > 0;
+    }
+
+    sqlite3_stmt* stmt = nullptr;
+    unsigned int flags = persistent ? SQLITE_PREPARE_PERSISTENT : 0;
+    if (sqlite3_prepare_v3(conn->db, sql, -1, flags, &stmt, nullptr) != SQLITE_OK) {
+        sqlite3_finalize(stmt);
+        return nullptr;
+    }
+    return stmt;
+}
+
+// Resets a statement and hands it back to the cache, finalizing whatever no longer fits.
+void release_statement(Connection* conn, const std::string& sql, sqlite3_stmt* stmt) {
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+
+    std::vector<sqlite3_stmt*> evicted;
+    {
+        std::lock_guard<std::mutex> lock(conn->cache_mutex);
+        StatementCache& cache = conn->cache;
+        if (cache.capacity == 0 || cache.index.count(sql)) {
+            evicted.push_back(stmt);
+        } else {
+            cache.entries.emplace_front(sql, stmt);
+            cache.index[sql] = cache.entries.begin();
+            while (cache.entries.size() > cache.capacity) {
+                evicted.push_back(cache.entries.back().second);
+                cache.index.erase(cache.entries.back().first);
+                cache.entries.pop_back();
+                cache.evictions++;
+            }
+        }
+    }
+    for (sqlite3_stmt* s : evicted) sqlite3_finalize(s);
+}
+
+// Trims the cache to `capacity` entries; a capacity of zero disables caching.
+void resize_cache(Connection* conn, size_t capacity) {
+    std::vector<sqlite3_stmt*> evicted;
+    {
+        std::lock_guard<std::mutex> lock(conn->cache_mutex);
+        StatementCache& cache = conn->cache;
+        cache.capacity = capacity;
+        while (cache.entries.size() > cache.capacity) {
+            evicted.push_back(cache.entries.back().second);
+            cache.index.erase(cache.entries.back().first);
+            cache.entries.pop_back();
+            cache.evictions++;
+        }
+    }
+    for (sqlite3_stmt* s : evicted) sqlite3_finalize(s);
+}
+
+// Runs a statement without result rows through the cache, e.g. transaction control.
+int run_cached(Connection* conn, const std::string& sql) {
+    sqlite3_stmt* stmt = acquire_statement(conn, sql.c_str());
+    if (!stmt) return sqlite3_errcode(conn->db);
+    int rc = sqlite3_step(stmt);
+    release_statement(conn, sql, stmt);
+    return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+// True unless the connection was opened with SQLITE_OPEN_NOMUTEX, in which case no other thread
+// may call into it while the script might.
+bool serialized(Connection* conn) { return sqlite3_db_mutex(conn->db) != nullptr; }
+
+// Commits the transaction opened by the batcher, if any, and returns SQLITE_OK or the error of
+// the COMMIT. Called with batch.mutex held.
+int commit_batch(Connection* conn) {
+    AutoBatch& batch = conn->batch;
+    if (!batch.open) return SQLITE_OK;
+    int rc = sqlite3_get_autocommit(conn->db) ? SQLITE_OK : run_cached(conn, "COMMIT");
+    // A COMMIT that failed with SQLITE_BUSY leaves the transaction open to be retried; one that
+    // SQLite answered by rolling back has nothing left to commit.
+    if (rc == SQLITE_OK || sqlite3_get_autocommit(conn->db)) batch.open = false;
+    return rc;
+}
+
+// True if any statement of `sql` modifies the database. SQL whose later statements cannot be
+// compiled yet, e.g. because an earlier one creates their table, counts as a write.
+bool writes_database(sqlite3* db, const char* sql) {
+    while (*sql) {
+        sqlite3_stmt* stmt = nullptr;
+        const char* tail = nullptr;
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, &tail) != SQLITE_OK) return true;
+        bool write = stmt && !sqlite3_stmt_readonly(stmt);
+        sqlite3_finalize(stmt);
+        if (write) return true;
+        sql = tail;
+    }
+    return false;
+}
+
+// Opens the batch transaction ahead of a write unless a transaction is already active. With
+// `sql`, the transaction is only opened if that SQL actually writes.
+void batch_before_write(Connection* conn, const char* sql = nullptr) {
+    AutoBatch& batch = conn->batch;
+    std::lock_guard<std::mutex> lock(batch.mutex);
+    if (!batch.enabled || !sqlite3_get_autocommit(conn->db)) return;
+    if (sql && !writes_database(conn->db, sql)) return;
+    // Autocommit is authoritative: a prepared COMMIT from the script can end a batch that is still marked open.
+    if (run_cached(conn, "BEGIN") != SQLITE_OK) return;
+    batch.open = true;
+    batch.writes = 0;
+    batch.opened = std::chrono::steady_clock::now();
+    batch.wake.notify_one();
+}
+
+// Counts completed writes and commits once the batch limits are reached. Returns SQLITE_OK or
+// the error of that COMMIT, which the write that triggered it reports.
+int batch_after_write(Connection* conn, int64_t writes) {
+    AutoBatch& batch = conn->batch;
+    std::lock_guard<std::mutex> lock(batch.mutex);
+    if (!batch.open) return SQLITE_OK;
+    if (sqlite3_get_autocommit(conn->db)) {
+        // The script ended the transaction itself.
+        batch.open = false;
+        return SQLITE_OK;
+    }
+
+    batch.writes += writes;
+    bool full = batch.max_writes > 0 && batch.writes >= batch.max_writes;
+    bool expired = batch.max_ms > 0 &&
+        std::chrono::steady_clock::now() - batch.opened >= std::chrono::milliseconds(batch.max_ms);
+    return full || expired ? commit_batch(conn) : SQLITE_OK;
+}
+
+// Commits a batch that has outlived its time limit. The timer thread does this on its own for
+// serialized connections; on others it happens when the script next calls into the connection.
+void batch_expire(Connection* conn) {
+    AutoBatch& batch = conn->batch;
+    std::lock_guard<std::mutex> lock(batch.mutex);
+    if (batch.open && batch.max_ms > 0 &&
+        std::chrono::steady_clock::now() - batch.opened >= std::chrono::milliseconds(batch.max_ms))
+        commit_batch(conn);
+}
+
+// Body of the timer thread: sleeps until the open batch reaches max_ms and commits it, so that
+// an idle script does not keep the write lock. A COMMIT that fails is retried after another
+// max_ms.
+void batch_timer_run(Connection* conn) {
+    AutoBatch& batch = conn->batch;
+    std::unique_lock<std::mutex> lock(batch.mutex);
+    while (!batch.stop) {
+        if (!batch.open || batch.max_ms == 0) {
+            batch.wake.wait(lock);
+            continue;
+        }
+        std::chrono::steady_clock::time_point due = batch.opened + std::chrono::milliseconds(batch.max_ms);
+        if (std::chrono::steady_clock::now() < due) {
+            batch.wake.wait_until(lock, due);
+            continue;
+        }
+        if (commit_batch(conn) != SQLITE_OK && batch.open) batch.opened = std::chrono::steady_clock::now();
+    }
+}
+
+void stop_batch_timer(Connection* conn) {
+    AutoBatch& batch = conn->batch;
+    if (!batch.timer.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(batch.mutex);
+        batch.stop = true;
+    }
+    batch.wake.notify_one();
+    batch.timer.join();
+    std::lock_guard<std::mutex> lock(batch.mutex);
+    batch.stop = false;
+}
+
+bool starts_with_keyword(const char* sql, const char* keyword) {
+    while (isspace((unsigned char)*sql)) sql++;
+    size_t len = strlen(keyword);
+    return sqlite3_strnicmp(sql, keyword, (int)len) == 0 && !isalnum((unsigned char)sql[len]) && sql[len] != '_';
+}
+
+// True for SQL starting with BEGIN or SAVEPOINT. BEGIN cannot run while a batch transaction is
+// open, and a savepoint would nest inside it and be committed along with the batch.
+bool begins_transaction(const char* sql) {
+    return starts_with_keyword(sql, "BEGIN") || starts_with_keyword(sql, "SAVEPOINT");
+}
+
+// Transaction control counts as read-only to SQLite but always belongs on a pool's writer.
+bool is_transaction_control(const char* sql) {
+    for (const char* keyword : {"BEGIN", "COMMIT", "END", "ROLLBACK", "SAVEPOINT", "RELEASE"}) {
+        if (starts_with_keyword(sql, keyword)) return true;
+    }
+    return false;
+}
+
+// Picks the pool reader with the fewest checked-out statements.
+int pick_reader(Connection* conn) {
+    static std::atomic<unsigned> rotation{0};
+    size_t count = conn->readers.size();
+    size_t start = rotation.fetch_add(1, std::memory_order_relaxed) % count;
+    size_t best = start;
+    for (size_t i = 1; i < count && conn->readers[best]->active.load(std::memory_order_relaxed) > 0; i++) {
+        size_t candidate = (start + i) % count;
+        if (conn->readers[candidate]->active.load(std::memory_order_relaxed) <
+            conn->readers[best]->active.load(std::memory_order_relaxed))
+            best = candidate;
+    }
+    return (int)best;
+}
+
+// Like acquire_statement, but on a pool sends read-only statements to an idle reader.
+// Reads stay on the writer while it has a transaction open, so they see its uncommitted changes.
+sqlite3_stmt* acquire_routed(Connection* conn, const char* sql, int* reader) {
+    *reader = -1;
+    if (conn->readers.empty() || !sqlite3_get_autocommit(conn->db) || is_transaction_control(sql))
+        return acquire_statement(conn, sql);
+
+    // Reads are not put back into a pool writer's cache (see release_routed), so a hit there is
+    // normally a write and settles the routing. A read that got in some other way, e.g. through
+    // sqlite_exec_many, is dropped so that it goes to a reader.
+    {
+        std::lock_guard<std::mutex> lock(conn->cache_mutex);
+        sqlite3_stmt* stmt = take_cached(conn->cache, sql);
+        if (stmt && !sqlite3_stmt_readonly(stmt)) return stmt;
+        sqlite3_finalize(stmt);
+    }
+
+    int index = pick_reader(conn);
+    Connection* target = conn->readers[index];
+    sqlite3_stmt* stmt = acquire_statement(target, sql);
+    if (!stmt) return acquire_statement(conn, sql);
+    if (!sqlite3_stmt_readonly(stmt)) {
+        sqlite3_finalize(stmt);
+        return acquire_statement(conn, sql);
+    }
+
+    target->active.fetch_add(1, std::memory_order_relaxed);
+    *reader = index;
+    return stmt;
+}
+
+// Counterpart of acquire_routed.
+void release_routed(Connection* conn, int reader, const std::string& sql, sqlite3_stmt* stmt) {
+    if (reader < 0) {
+        // A read that ran on the writer because a transaction was open would otherwise be found
+        // in the writer's cache and keep every later run of its SQL off the readers.
+        if (!conn->readers.empty() && sqlite3_stmt_readonly(stmt) && !is_transaction_control(sql.c_str()))
+            sqlite3_finalize(stmt);
+        else
+            release_statement(conn, sql, stmt);
+        return;
+    }
+    Connection* target = conn->readers[reader];
+    release_statement(target, sql, stmt);
+    target->active.fetch_sub(1, std::memory_order_relaxed);
+}
+
+// Commits a pending batch so that the script can open its own transaction.
+void batch_yield(Connection* conn) {
+    std::lock_guard<std::mutex> lock(conn->batch.mutex);
+    commit_batch(conn);
+}
+
+// Runs one group: everything that was pending, in one transaction, one savepoint per job so a
+// failing job is undone without taking the others with it.
+void write_queue_group(Connection* conn, std::vector<WriteJob*>& group) {
+    WriteQueue& queue = conn->queue;
+    // Jobs of the open transaction: those whose callers wait for its outcome, and a count of
+    // those that were answered as soon as they ran.
+    std::vector<WriteJob*> waiting;
+    size_t answered = 0;
+    bool open = false;
+    // If a transaction cannot start, e.g. another process holds the write lock past the busy
+    // timeout, the remaining jobs run, each in its own autocommit transaction.
+    bool can_open = true;
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.groups++;
+        queue.jobs += group.size();
+    }
+
+    // Hands the final result of the transaction to its jobs. A job that succeeded inside a
+    // transaction that did not commit has failed after all.
+    auto settle = [&](int rc) {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (rc != SQLITE_OK) queue.failures += answered;
+        for (WriteJob* job : waiting) {
+            if (rc != SQLITE_OK && job->rc == SQLITE_OK) {
+                job->rc = rc;
+                queue.failures++;
+            }
+            job->settled = true;
+        }
+        waiting.clear();
+        answered = 0;
+        queue.finished.notify_all();
+    };
+
+    auto commit = [&] {
+        int rc = run_cached(conn, "COMMIT");
+        if (rc != SQLITE_OK && !sqlite3_get_autocommit(conn->db)) run_cached(conn, "ROLLBACK");
+        open = false;
+        settle(rc);
+    };
+
+    for (WriteJob* job : group) {
+        // An interrupted write rolls back the whole transaction it runs in. A job that may be
+        // interrupted by its deadline therefore runs on its own, after the jobs before it commit.
+        if (job->isolated) {
+            if (open) commit();
+        } else if (!open && can_open) {
+            can_open = open = run_cached(conn, "BEGIN IMMEDIATE") == SQLITE_OK;
+        }
+
+        int rc;
+        if (open && run_cached(conn, "SAVEPOINT phasor_queue") == SQLITE_OK) {
+            rc = job->run();
+            if (rc != SQLITE_OK && !sqlite3_get_autocommit(conn->db)) run_cached(conn, "ROLLBACK TO phasor_queue");
+            if (!sqlite3_get_autocommit(conn->db)) run_cached(conn, "RELEASE phasor_queue");
+        } else {
+            rc = job->run();
+        }
+        if (open && sqlite3_get_autocommit(conn->db)) {
+            // Interrupts, I/O errors, a full disk or running out of memory make SQLite roll back
+            // the whole transaction, taking the jobs before this one with it. The rest of the
+            // group continues in a new transaction.
+            open = false;
+            settle(rc != SQLITE_OK ? rc : SQLITE_ABORT);
+        }
+
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (rc != SQLITE_OK) queue.failures++;
+        job->rc = rc;
+        job->executed = true;
+        if (open && rc == SQLITE_OK && !job->wait_commit) answered++;
+        // Jobs that do not wait for the commit belong to their callers again from here on.
+        if (job->detached) {
+            delete job;
+        } else if (job->wait_commit) {
+            if (open && rc == SQLITE_OK) waiting.push_back(job);
+            else job->settled = true; // nothing left to commit
+        }
+        queue.finished.notify_all();
+    }
+
+    if (open) commit();
+}
+
+void write_queue_run(Connection* conn) {
+    WriteQueue& queue = conn->queue;
+    std::vector<WriteJob*> group;
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    for (;;) {
+        queue.wake.wait(lock, [&] { return queue.stop || !queue.pending.empty(); });
+        if (queue.pending.empty()) break; // stopping, and everything has been drained
+        group.assign(queue.pending.begin(), queue.pending.end());
+        queue.pending.clear();
+        lock.unlock();
+        write_queue_group(conn, group);
+        lock.lock();
+    }
 }
 
-sqlite3_stmt* get_stmt(int handle) {
-    std::lock_guard<std::mutex> lock(stmt_mutex);
-    auto it = stmt_table.find(handle);
-    return it != stmt_table.end() ? it->second : nullptr;
+bool write_queue_active(Connection* conn) {
+    std::lock_guard<std::mutex> lock(conn->queue.mutex);
+    return conn->queue.running;
+}
+
+// Drains and stops the writer thread. Pending jobs are committed before it exits.
+void stop_write_queue(Connection* conn) {
+    WriteQueue& queue = conn->queue;
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.running) return;
+        queue.stop = true;
+    }
+    queue.wake.notify_one();
+    queue.thread.join();
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.running = false;
+    queue.stop = false;
+}
+
+// Hands `run` to the writer thread. Returns false without running it if the queue is off, so
+// the caller can take the direct path. Otherwise `rc` receives the job's result once it ran,
+// or once its group settled when waiting for the commit; fire-and-forget jobs report SQLITE_OK.
+// `wait_commit` is 1 or 0, or -1 for the queue's default. `wait_run` keeps the caller waiting
+// for the job to run even when it does not wait for the commit, for results it needs.
+bool enqueue_write(Connection* conn, std::function<int()> run, int wait_commit, bool wait_run, int* rc,
+                   bool isolated = false) {
+    WriteQueue& queue = conn->queue;
+    WriteJob* job = new WriteJob();
+    job->run = std::move(run);
+    job->isolated = isolated;
+
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    if (!queue.running || queue.stop) {
+        lock.unlock();
+        delete job;
+        return false;
+    }
+    job->wait_commit = wait_commit < 0 ? queue.wait_commit : wait_commit != 0;
+    job->detached = !job->wait_commit && !wait_run;
+    queue.pending.push_back(job);
+    queue.wake.notify_one();
+    if (job->detached) {
+        *rc = SQLITE_OK;
+        return true;
+    }
+
+    queue.finished.wait(lock, [&] { return job->wait_commit ? job->settled : job->executed; });
+    *rc = job->rc;
+    lock.unlock();
+    delete job;
+    return true;
+}
+
+// Converts one column of the current row. TEXT values point into SQLite's own row buffer;
+// the VM copies strings it is handed, so no intermediate copy is made here.
+// A BLOB becomes an array of byte values appended to `bytes`; until pin_blob() runs, the array
+// holds the offset of its first byte instead of a pointer, since the arena may still grow.
+// Without `bytes`, BLOBs read as null.
+PhasorValue column_value(sqlite3_stmt* stmt, int col, std::vector<PhasorValue>* bytes = nullptr) {
+    switch (sqlite3_column_type(stmt, col)) {
+    case SQLITE_INTEGER: return phasor_make_int(sqlite3_column_int64(stmt, col));
+    case SQLITE_FLOAT:   return phasor_make_float(sqlite3_column_double(stmt, col));
+    case SQLITE_TEXT: {
+        const unsigned char* text = sqlite3_column_text(stmt, col);
+        return text ? phasor_make_string((const char*)text) : phasor_make_null();
+    }
+    case SQLITE_BLOB: {
+        if (!bytes) return phasor_make_null();
+        const unsigned char* data = (const unsigned char*)sqlite3_column_blob(stmt, col);
+        size_t size = (size_t)sqlite3_column_bytes(stmt, col);
+        size_t offset = bytes->size();
+        bytes->resize(offset + size);
+        for (size_t i = 0; i < size; i++) (*bytes)[offset + i] = phasor_make_int(data[i]);
+        return phasor_make_array((const PhasorValue*)(uintptr_t)offset, size);
+    }
+    default: return phasor_make_null();
+    }
+}
+
+// Turns the offset left in a BLOB array by column_value() into a pointer into `bytes`.
+void pin_blob(PhasorValue& value, const std::vector<PhasorValue>& bytes) {
+    if (phasor_is_array(value)) value.as.a.elements = bytes.data() + (uintptr_t)value.as.a.elements;
+}
+
+// Deadline of the SQLite call in progress on this thread, armed by sqlite_set_timeout. Each
+// thread checks only its own deadline, so concurrent calls on one connection stay independent.
+struct Deadline {
+    sqlite3* db;
+    int64_t ms;
+    std::chrono::steady_clock::time_point at;
+    bool expired = false;
+    Deadline* previous;
+    static thread_local Deadline* current;
+
+    Deadline(sqlite3* db, int64_t ms) : db(db), ms(ms), previous(current) {
+        if (ms > 0) at = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+        current = this;
+    }
+    ~Deadline() { current = previous; }
+};
+thread_local Deadline* Deadline::current = nullptr;
+
+// Progress handler installed by sqlite_set_timeout; a non-zero return interrupts the call.
+int check_deadline(void* db) {
+    Deadline* deadline = Deadline::current;
+    if (!deadline || deadline->db != db || deadline->ms <= 0) return 0;
+    if (std::chrono::steady_clock::now() < deadline->at) return 0;
+    deadline->expired = true;
+    return 1;
+}
+
+// sqlite3_wal_hook callback, run by the committing thread while it holds the connection.
+int checkpointer_hook(void* arg, sqlite3*, const char* schema, int pages) {
+    Checkpointer& checkpointer = *(Checkpointer*)arg;
+    if (strcmp(schema, "main") != 0) return SQLITE_OK;
+    bool due;
+    {
+        std::lock_guard<std::mutex> lock(checkpointer.mutex);
+        checkpointer.pages = pages;
+        due = pages >= checkpointer.passive_pages;
+    }
+    if (due) checkpointer.wake.notify_one();
+    return SQLITE_OK;
+}
+
+// A PASSIVE checkpoint copies what it can without taking any lock, but the WAL only starts over
+// once no reader needs its old frames. If it keeps growing past the higher thresholds, RESTART
+// and then TRUNCATE force that. They hold the write lock while they run, so they only follow a
+// PASSIVE pass that has already copied nearly everything, and give up with SQLITE_BUSY rather
+// than wait for readers.
+void checkpointer_run(Checkpointer* checkpointer) {
+    std::unique_lock<std::mutex> lock(checkpointer->mutex);
+    for (;;) {
+        checkpointer->wake.wait(lock, [&] {
+            return checkpointer->stop || checkpointer->pages >= checkpointer->passive_pages;
+        });
+        if (checkpointer->stop) break;
+        int pages = checkpointer->pages;
+        int mode = pages < checkpointer->escalate_pages         ? SQLITE_CHECKPOINT_PASSIVE
+                   : pages >= checkpointer->truncate_pages  ? SQLITE_CHECKPOINT_TRUNCATE
+                   : pages >= checkpointer->restart_pages ? SQLITE_CHECKPOINT_RESTART
+                                                          : SQLITE_CHECKPOINT_PASSIVE;
+        checkpointer->pages = 0;
+        lock.unlock();
+        int rc = sqlite3_wal_checkpoint_v2(checkpointer->db, "main", SQLITE_CHECKPOINT_PASSIVE, nullptr, nullptr);
+        if (rc == SQLITE_OK && mode != SQLITE_CHECKPOINT_PASSIVE)
+            rc = sqlite3_wal_checkpoint_v2(checkpointer->db, "main", mode, nullptr, nullptr);
+        lock.lock();
+        // A failed escalation is not repeated on every commit, only once the WAL has grown
+        // by another PASSIVE threshold.
+        if (mode != SQLITE_CHECKPOINT_PASSIVE)
+            checkpointer->escalate_pages = rc == SQLITE_BUSY ? pages + checkpointer->passive_pages : 0;
+        if (rc == SQLITE_BUSY) checkpointer->busy++;
+        else if (mode == SQLITE_CHECKPOINT_TRUNCATE) checkpointer->truncates++;
+        else if (mode == SQLITE_CHECKPOINT_RESTART) checkpointer->restarts++;
+        else checkpointer->passive++;
+    }
+}
+
+void stop_checkpointer(Connection* conn) {
+    Checkpointer& checkpointer = conn->checkpointer;
+    {
+        std::lock_guard<std::mutex> lock(checkpointer.mutex);
+        if (!checkpointer.running) return;
+    }
+    // Also replaces the hook, so once it returns no commit will call it again.
+    sqlite3_wal_autocheckpoint(conn->db, checkpointer.autocheckpoint);
+    {
+        std::lock_guard<std::mutex> lock(checkpointer.mutex);
+        checkpointer.stop = true;
+    }
+    checkpointer.wake.notify_one();
+    checkpointer.thread.join();
+    sqlite3_close(checkpointer.db);
+    std::lock_guard<std::mutex> lock(checkpointer.mutex);
+    checkpointer.db = nullptr;
+    checkpointer.running = false;
+    checkpointer.stop = false;
+    checkpointer.pages = 0;
+    checkpointer.escalate_pages = 0;
+}
+
+// Exponential backoff with jitter: a random delay between half and all of
+// initial * 2^attempt, capped, so that waiting processes spread out instead of retrying in step.
+std::chrono::milliseconds backoff_delay(const BusyPolicy& busy, int attempt) {
+    static thread_local std::minstd_rand random(
+        (unsigned)std::hash<std::thread::id>()(std::this_thread::get_id()) ^
+        (unsigned)std::chrono::steady_clock::now().time_since_epoch().count());
+    int64_t delay = std::max<int64_t>(busy.initial_ms.load(std::memory_order_relaxed), 1);
+    int64_t cap = std::max<int64_t>(busy.max_ms.load(std::memory_order_relaxed), delay);
+    for (int i = 0; i < attempt && delay < cap; i++) delay *= 2;
+    delay = std::min(delay, cap);
+    return std::chrono::milliseconds(delay / 2 + (int64_t)(random() % (uint64_t)(delay - delay / 2 + 1)));
+}
+
+// sqlite3_busy_handler callback for sqlite_busy_backoff; `count` restarts at 0 for every wait.
+int busy_backoff(void* arg, int count) {
+    BusyPolicy& busy = *(BusyPolicy*)arg;
+    static thread_local std::chrono::steady_clock::time_point started;
+    auto now = std::chrono::steady_clock::now();
+    if (count == 0) started = now;
+    auto left = started + std::chrono::milliseconds(busy.total_ms.load(std::memory_order_relaxed)) - now;
+    if (left <= std::chrono::steady_clock::duration::zero()) return 0;
+
+    busy.waits.fetch_add(1, std::memory_order_relaxed);
+    std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(backoff_delay(busy, count), left));
+    return 1;
+}
+
+// Runs `call` again after a backoff delay while it fails with BUSY or LOCKED, up to the
+// connection's retry budget. Only calls outside a transaction are retried: inside one, the
+// transaction itself has to be rolled back to let the other side finish.
+template <typename Call, typename Repeatable>
+int with_retry(Connection* conn, sqlite3* db, Call call, Repeatable repeatable) {
+    int rc = call();
+    auto contended = [&rc] { return (rc & 0xff) == SQLITE_BUSY || (rc & 0xff) == SQLITE_LOCKED; };
+    if (!conn || !contended()) return rc;
+
+    BusyPolicy& busy = conn->busy;
+    int budget = busy.retries.load(std::memory_order_relaxed);
+    for (int attempt = 0; contended() && attempt < budget && sqlite3_get_autocommit(db) && repeatable(); attempt++) {
+        busy.retried.fetch_add(1, std::memory_order_relaxed);
+        std::this_thread::sleep_for(backoff_delay(busy, attempt));
+        rc = call();
+    }
+    if (contended()) busy.failures.fetch_add(1, std::memory_order_relaxed);
+    return rc;
+}
+
+template <typename Call>
+int with_retry(Connection* conn, sqlite3* db, Call call) {
+    return with_retry(conn, db, call, [] { return true; });
+}
+
+// Wakes the other side of the ring after this side published a change, if it is asleep.
+void prefetch_notify(Prefetcher* prefetch) {
+    // Pairs with the fence in prefetch_wait: either the sleeper sees the change or this sees it.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (prefetch->sleepers.load(std::memory_order_relaxed) == 0) return;
+    std::lock_guard<std::mutex> lock(prefetch->mutex);
+    prefetch->wake.notify_all();
+}
+
+// Waits until `ready` holds. Most waits are a row or two long, so it spins and yields for a
+// bounded time first, then sleeps, so that a script that stops reading, or a slow step in the
+// producer, does not keep a core busy.
+template <typename Ready>
+void prefetch_wait(Prefetcher* prefetch, Ready ready) {
+    for (int spins = 0; spins < 256; spins++) {
+        if (ready()) return;
+        if (spins >= 64) std::this_thread::yield();
+    }
+    std::unique_lock<std::mutex> lock(prefetch->mutex);
+    prefetch->sleepers.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (!ready()) prefetch->wake.wait(lock);
+    prefetch->sleepers.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void prefetch_produce(sqlite3_stmt* stmt, Prefetcher* prefetch) {
+    uint64_t size = prefetch->ring.size();
+    for (uint64_t head = 0; ; head++) {
+        prefetch_wait(prefetch, [&] {
+            return prefetch->stop.load(std::memory_order_relaxed) ||
+                   head - prefetch->tail.load(std::memory_order_acquire) < size;
+        });
+        if (prefetch->stop.load(std::memory_order_relaxed)) break;
+
+        Deadline deadline(sqlite3_db_handle(stmt), prefetch->timeout_ms);
+        int rc = sqlite3_step(stmt);
+        if (rc != SQLITE_ROW) {
+            prefetch->result = rc;
+            prefetch->timed_out = deadline.expired;
+            break;
+        }
+
+        // Same offset-then-pointer scheme as sqlite_fetch_many, per ring row.
+        PrefetchRow& row = prefetch->ring[head % size];
+        int count = sqlite3_data_count(stmt);
+        row.values.resize(count);
+        row.text.clear();
+        row.bytes.clear();
+        for (int c = 0; c < count; c++) {
+            PhasorValue& value = row.values[c];
+            value = column_value(stmt, c, &row.bytes);
+            if (phasor_is_string(value)) {
+                const char* text = phasor_to_string(value);
+                size_t len = (size_t)sqlite3_column_bytes(stmt, c);
+                value.as.i = (int64_t)row.text.size();
+                row.text.insert(row.text.end(), text, text + len);
+                row.text.push_back('\0');
+            }
+        }
+        for (PhasorValue& value : row.values) {
+            if (phasor_is_string(value)) value.as.s = row.text.data() + value.as.i;
+            pin_blob(value, row.bytes);
+        }
+        prefetch->head.store(head + 1, std::memory_order_release);
+        prefetch_notify(prefetch);
+    }
+    prefetch->finished.store(true, std::memory_order_release);
+    prefetch_notify(prefetch);
+}
+
+// Joins the producer. The statement is left wherever the producer stopped, so callers
+// that keep using it reset it first.
+void stop_prefetch(Statement* statement) {
+    Prefetcher* prefetch = statement->prefetch;
+    if (!prefetch) return;
+    prefetch->stop.store(true, std::memory_order_relaxed);
+    prefetch_notify(prefetch);
+    prefetch->thread.join();
+    delete prefetch;
+    statement->prefetch = nullptr;
+}
+
+// Consumer side of sqlite3_step for a prefetching statement; starts the producer on first use.
+int prefetch_step(Statement* statement, Connection* conn) {
+    Prefetcher* prefetch = statement->prefetch;
+    if (!prefetch) {
+        prefetch = new Prefetcher();
+        prefetch->ring.resize(statement->prefetch_depth);
+        prefetch->timeout_ms = conn ? conn->timeout_ms.load() : 0;
+        prefetch->thread = std::thread(prefetch_produce, statement->stmt, prefetch);
+        statement->prefetch = prefetch;
+    }
+
+    uint64_t tail = prefetch->tail.load(std::memory_order_relaxed);
+    if (prefetch->holding) {
+        prefetch->tail.store(++tail, std::memory_order_release);
+        prefetch->holding = false;
+        prefetch_notify(prefetch);
+    }
+
+    bool available = false;
+    prefetch_wait(prefetch, [&] {
+        if (prefetch->head.load(std::memory_order_acquire) > tail) return available = true;
+        // The last row may have been published just before `finished`.
+        if (prefetch->finished.load(std::memory_order_acquire))
+            return (available = prefetch->head.load(std::memory_order_acquire) > tail), true;
+        return false;
+    });
+    if (available) {
+        prefetch->holding = true;
+        return SQLITE_ROW;
+    }
+
+    int rc = prefetch->result;
+    statement->timed_out = prefetch->timed_out;
+    stop_prefetch(statement);
+    return rc;
+}
+
+// Row currently held by a prefetching statement's consumer, or nullptr.
+const PrefetchRow* prefetched_row(const Statement* statement) {
+    const Prefetcher* prefetch = statement->prefetch;
+    if (!prefetch || !prefetch->holding) return nullptr;
+    return &prefetch->ring[prefetch->tail.load(std::memory_order_relaxed) % prefetch->ring.size()];
+}
+
+// Value of one column of the current row, whether it came from SQLite or the prefetch ring.
+// A BLOB array stays valid until the next call for this statement.
+PhasorValue row_value(Statement* statement, int col) {
+    const PrefetchRow* row = prefetched_row(statement);
+    if (row) return (size_t)col < row->values.size() ? row->values[col] : phasor_make_null();
+
+    statement->column_bytes.clear();
+    PhasorValue value = column_value(statement->stmt, col, &statement->column_bytes);
+    pin_blob(value, statement->column_bytes);
+    return value;
+}
+
+// Steps a statement, routing writes through the batcher. Read-only statements skip it entirely.
+int step_direct(Statement* statement, Connection* conn) {
+    sqlite3_stmt* stmt = statement->stmt;
+    int64_t timeout_ms = conn ? conn->timeout_ms.load(std::memory_order_relaxed) : 0;
+    auto step = [stmt] { return sqlite3_step(stmt); };
+    if (statement->readonly || !conn) {
+        Deadline deadline(sqlite3_db_handle(stmt), timeout_ms);
+        int rc = with_retry(conn, sqlite3_db_handle(stmt), step);
+        statement->timed_out = deadline.expired;
+        return rc;
+    }
+
+    if (!sqlite3_stmt_busy(stmt) && write_queue_active(conn)) {
+        // The writer thread owns the transaction, and a RETURNING statement left pending
+        // between steps would keep it from committing.
+        if (statement->controls_transaction || sqlite3_column_count(stmt) > 0) return SQLITE_MISUSE;
+        int step_rc = SQLITE_MISUSE;
+        int rc;
+        bool queued = enqueue_write(conn, [&] {
+            Deadline deadline(sqlite3_db_handle(stmt), timeout_ms);
+            step_rc = with_retry(conn, conn->db, step);
+            statement->timed_out = deadline.expired;
+            return step_rc == SQLITE_DONE ? SQLITE_OK : step_rc;
+        }, -1, true, &rc, timeout_ms > 0);
+        if (queued) return rc == SQLITE_OK ? step_rc : rc;
+    }
+
+    Deadline deadline(conn->db, timeout_ms);
+    int rc;
+    if (statement->begins_transaction) {
+        batch_yield(conn);
+        rc = with_retry(conn, conn->db, step);
+    } else {
+        bool starting = !sqlite3_stmt_busy(stmt);
+        if (starting) batch_before_write(conn);
+        rc = with_retry(conn, conn->db, step);
+        if (rc != SQLITE_ROW) {
+            // A write that completed but whose batch failed to commit reports the COMMIT's error.
+            int commit_rc = batch_after_write(conn, rc == SQLITE_DONE ? 1 : 0);
+            if (rc == SQLITE_DONE && commit_rc != SQLITE_OK) rc = commit_rc;
+        }
+    }
+    statement->timed_out = deadline.expired;
+    return rc;
+}
+
+// Every path that steps a statement for the script goes through here.
+int step_statement(Statement* statement) {
+    release_views(statement);
+    // SQLite would restart an interrupted statement from the top, so it stays stopped until reset.
+    if (statement->aborted) return SQLITE_MISUSE;
+    Connection* conn = get_connection(statement->db_handle);
+    int rc = statement->prefetch_depth ? prefetch_step(statement, conn) : step_direct(statement, conn);
+    if (rc == SQLITE_INTERRUPT) statement->aborted = true;
+    return rc;
+}
+
+bool valid_identifier(const char* name) {
+    if (!name || !(isalpha((unsigned char)*name) || *name == '_')) return false;
+    for (const char* p = name + 1; *p; p++) {
+        if (!isalnum((unsigned char)*p) && *p != '_') return false;
+    }
+    return true;
+}
+
+// Hands an open connection to the handle table; closes it and returns 0 if the table is full.
+int register_connection(sqlite3* db) {
+    Connection* conn = new Connection();
+    conn->db = db;
+
+    int handle = db_table.insert(conn);
+    if (!handle) {
+        sqlite3_close(db);
+        delete conn;
+    }
+    return handle;
+}
+
+bool apply_lookaside(sqlite3* db);
+
+PhasorValue sqlite_open(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 1 || !phasor_is_string(argv[0])) return phasor_make_null();
+    const char* filename = phasor_to_string(argv[0]);
+    sqlite3* db = nullptr;
+    if (sqlite3_open(filename, &db) != SQLITE_OK || !apply_lookaside(db)) { sqlite3_close(db); return phasor_make_null(); }
+
+    int handle = register_connection(db);
+    return handle ? phasor_make_int(handle) : phasor_make_null();
+}
+
+struct OpenOptions {
+    int flags = 0;
+    std::vector<std::pair<std::string, std::string>> pragmas;
+};
+
+// Pragmas that may be set at open time. page_size is applied first so it takes effect
+// before journal_mode=WAL fixes the page size of a new database.
+static const char* const open_pragmas[] = {
+    "page_size", "journal_mode", "synchronous", "cache_size", "mmap_size", "temp_store",
+    "foreign_keys", "busy_timeout", "locking_mode", "journal_size_limit", "wal_autocheckpoint",
+};
+
+bool parse_open_option(const std::string& option, OpenOptions& options) {
+    static const std::pair<const char*, int> open_flags[] = {
+        {"readonly", SQLITE_OPEN_READONLY},
+        {"readwrite", SQLITE_OPEN_READWRITE},
+        {"create", SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE},
+        {"uri", SQLITE_OPEN_URI},
+        {"memory", SQLITE_OPEN_MEMORY},
+        {"nomutex", SQLITE_OPEN_NOMUTEX},
+        {"fullmutex", SQLITE_OPEN_FULLMUTEX},
+        {"sharedcache", SQLITE_OPEN_SHAREDCACHE},
+        {"privatecache", SQLITE_OPEN_PRIVATECACHE},
+        {"nofollow", SQLITE_OPEN_NOFOLLOW},
+    };
+
+    size_t eq = option.find('=');
+    if (eq == std::string::npos) {
+        for (const auto& flag : open_flags) {
+            if (sqlite3_stricmp(option.c_str(), flag.first) == 0) {
+                options.flags |= flag.second;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::string name = option.substr(0, eq);
+    std::string value = option.substr(eq + 1);
+    // Values are spliced into PRAGMA text, so only plain words and numbers are accepted.
+    if (value.empty()) return false;
+    for (char c : value) {
+        if (!isalnum((unsigned char)c) && c != '_' && c != '-') return false;
+    }
+    for (const char* pragma : open_pragmas) {
+        if (sqlite3_stricmp(name.c_str(), pragma) == 0) {
+            options.pragmas.emplace_back(pragma, value);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Options are either one string separated by ';', ',' or whitespace, or an array of strings.
+bool split_options(const PhasorValue& value, std::vector<std::string>& items) {
+    if (phasor_is_string(value)) {
+        std::string current;
+        for (const char* p = phasor_to_string(value); ; p++) {
+            if (*p == '\0' || *p == ';' || *p == ',' || isspace((unsigned char)*p)) {
+                if (!current.empty()) items.push_back(current);
+                current.clear();
+                if (*p == '\0') break;
+            } else {
+                current += *p;
+            }
+        }
+    } else if (phasor_is_array(value)) {
+        for (size_t i = 0; i < value.as.a.count; i++) {
+            if (!phasor_is_string(value.as.a.elements[i])) return false;
+            items.push_back(phasor_to_string(value.as.a.elements[i]));
+        }
+    } else if (!phasor_is_null(value)) {
+        return false;
+    }
+    return true;
+}
+
+bool parse_open_options(const PhasorValue& value, OpenOptions& options) {
+    std::vector<std::string> items;
+    if (!split_options(value, items)) return false;
+    for (const std::string& item : items) {
+        if (!parse_open_option(item, options)) return false;
+    }
+    return true;
+}
+
+bool apply_open_pragmas(sqlite3* db, const OpenOptions& options) {
+    for (const char* pragma : open_pragmas) {
+        for (const auto& setting : options.pragmas) {
+            if (setting.first != pragma) continue;
+            std::string sql = "PRAGMA " + setting.first + "=" + setting.second;
+            if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK) return false;
+        }
+    }
+    return true;
+}
+
+// Scan-resistant page cache installed with SQLITE_CONFIG_PCACHE2 by sqlite_configure("pcache=2q").
+// Pages read for the first time go to a probation queue (A1in) and are evicted from there
+// first. A page is admitted to the protected LRU (Am) when it is fetched again after it was
+// released, or when it comes back soon after leaving A1in, as remembered by a ghost list of
+// evicted page numbers (A1out). A table scan fetches each leaf page once, so it cycles through
+// A1in without touching the hot pages in Am.
+//
+// The structures below have no locking of their own. They rely on SQLite never calling one
+// cache from two threads at once: a cache belongs to a single connection, or to a shared cache
+// whose own mutex guards it, and calls into a connection are serialized by its mutex or, for
+// connections opened with SQLITE_OPEN_NOMUTEX, by the caller using it from one thread at a time.
+namespace twoq {
+
+enum Queue { A1in, Am };
+
+struct Page {
+    sqlite3_pcache_page base; // must stay first; SQLite gets a pointer to it
+    unsigned key;
+    Queue queue;
+    bool pinned;
+    Page* prev; // neighbours in the queue's list while unpinned
+    Page* next;
+};
+
+// Unpinned pages of one queue, most recently released at the head.
+struct List {
+    Page* head = nullptr;
+    Page* tail = nullptr;
+
+    void push_front(Page* page) {
+        page->prev = nullptr;
+        page->next = head;
+        if (head) head->prev = page;
+        else tail = page;
+        head = page;
+    }
+    void remove(Page* page) {
+        if (page->prev) page->prev->next = page->next;
+        else head = page->next;
+        if (page->next) page->next->prev = page->prev;
+        else tail = page->prev;
+    }
+};
+
+// Counters are only written by whichever thread SQLite is calling the cache from, so relaxed
+// stores suffice; sqlite_pcache_stats reads them from other threads.
+struct Counters {
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> evictions{0};
+    std::atomic<uint64_t> promotions{0};
+};
+
+void bump(std::atomic<uint64_t>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+struct Cache {
+    int page_size;
+    int extra_size;
+    bool purgeable; // false for in-memory databases, whose pages must never be evicted
+    unsigned capacity = 100;
+    std::unordered_map<unsigned, Page*> pages;
+    List in;                  // unpinned A1in pages
+    List hot;                 // unpinned Am pages
+    size_t in_count = 0;      // A1in pages, pinned or not
+    size_t pinned = 0;
+    std::list<unsigned> ghosts; // A1out, newest first
+    std::unordered_map<unsigned, std::list<unsigned>::iterator> ghost_index;
+    Counters counters;
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<Cache*> caches;
+    Counters retired; // totals of destroyed caches
+};
+Registry& registry() {
+    static Registry* shared = new Registry();
+    return *shared;
+}
+
+bool installed = false;
+
+size_t in_target(const Cache* cache) {
+    return std::max<size_t>(1, cache->capacity / 4);
+}
+
+size_t ghost_target(const Cache* cache) {
+    return std::max<size_t>(1, cache->capacity / 2);
+}
+
+void forget_ghost(Cache* cache, unsigned key) {
+    auto ghost = cache->ghost_index.find(key);
+    if (ghost == cache->ghost_index.end()) return;
+    cache->ghosts.erase(ghost->second);
+    cache->ghost_index.erase(ghost);
+}
+
+void remember_ghost(Cache* cache, unsigned key) {
+    cache->ghosts.push_front(key);
+    cache->ghost_index[key] = cache->ghosts.begin();
+    while (cache->ghosts.size() > ghost_target(cache)) {
+        cache->ghost_index.erase(cache->ghosts.back());
+        cache->ghosts.pop_back();
+    }
+}
+
+// Takes an unpinned page out of the cache: from A1in while it holds more than its share,
+// otherwise the least recently used page of Am. Returns null if every page is pinned.
+Page* evict(Cache* cache) {
+    Page* victim = nullptr;
+    if (cache->in.tail && (cache->in_count > in_target(cache) || !cache->hot.tail)) victim = cache->in.tail;
+    else victim = cache->hot.tail;
+    if (!victim) return nullptr;
+
+    if (victim->queue == A1in) {
+        cache->in.remove(victim);
+        cache->in_count--;
+        remember_ghost(cache, victim->key);
+    } else {
+        cache->hot.remove(victim);
+    }
+    cache->pages.erase(victim->key);
+    bump(cache->counters.evictions);
+    return victim;
+}
+
+void discard(Cache* cache, Page* page) {
+    if (!page->pinned) (page->queue == A1in ? cache->in : cache->hot).remove(page);
+    else cache->pinned--;
+    if (page->queue == A1in) cache->in_count--;
+    cache->pages.erase(page->key);
+    sqlite3_free(page);
+}
+
+void shrink_to(Cache* cache, size_t limit) {
+    while (cache->pages.size() > limit) {
+        Page* page = evict(cache);
+        if (!page) break;
+        sqlite3_free(page);
+    }
+}
+
+int init(void*) {
+    return SQLITE_OK;
+}
+
+void shutdown(void*) {}
+
+sqlite3_pcache* create(int page_size, int extra_size, int purgeable) {
+    Cache* cache = new (std::nothrow) Cache();
+    if (!cache) return nullptr;
+    cache->page_size = page_size;
+    cache->extra_size = extra_size;
+    cache->purgeable = purgeable != 0;
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    registry().caches.push_back(cache);
+    return (sqlite3_pcache*)cache;
+}
+
+void cache_size(sqlite3_pcache* handle, int pages) {
+    Cache* cache = (Cache*)handle;
+    cache->capacity = (unsigned)std::max(pages, 1);
+    if (cache->purgeable) shrink_to(cache, cache->capacity);
+}
+
+int page_count(sqlite3_pcache* handle) {
+    return (int)((Cache*)handle)->pages.size();
+}
+
+sqlite3_pcache_page* fetch(sqlite3_pcache* handle, unsigned key, int create_flag) {
+    Cache* cache = (Cache*)handle;
+    auto found = cache->pages.find(key);
+    if (found != cache->pages.end()) {
+        Page* page = found->second;
+        bump(cache->counters.hits);
+        if (!page->pinned) {
+            (page->queue == A1in ? cache->in : cache->hot).remove(page);
+            if (page->queue == A1in) {
+                page->queue = Am;
+                cache->in_count--;
+                bump(cache->counters.promotions);
+            }
+            page->pinned = true;
+            cache->pinned++;
+        }
+        return &page->base;
+    }
+    if (create_flag == 0) return nullptr;
+    // With create_flag 1 SQLite only wants a page that is cheap to get.
+    if (create_flag == 1 && cache->purgeable && cache->pinned >= cache->capacity) return nullptr;
+
+    Page* page = nullptr;
+    if (cache->purgeable && cache->pages.size() >= cache->capacity) page = evict(cache);
+    if (!page) {
+        page = (Page*)sqlite3_malloc64(sizeof(Page) + (sqlite3_uint64)cache->page_size + cache->extra_size);
+        if (!page) return nullptr;
+        page->base.pBuf = (char*)page + sizeof(Page);
+        page->base.pExtra = (char*)page->base.pBuf + cache->page_size;
+    }
+    // SQLite recognizes a fresh page by a null pointer at the start of the extra space.
+    *(void**)page->base.pExtra = nullptr;
+    page->key = key;
+    page->pinned = true;
+    bump(cache->counters.misses);
+
+    auto ghost = cache->ghost_index.find(key);
+    if (ghost != cache->ghost_index.end()) {
+        // Back soon after leaving A1in: this page is hot.
+        cache->ghosts.erase(ghost->second);
+        cache->ghost_index.erase(ghost);
+        page->queue = Am;
+        bump(cache->counters.promotions);
+    } else {
+        page->queue = A1in;
+        cache->in_count++;
+    }
+    cache->pages[key] = page;
+    cache->pinned++;
+    return &page->base;
+}
+
+void unpin(sqlite3_pcache* handle, sqlite3_pcache_page* base, int discard_page) {
+    Cache* cache = (Cache*)handle;
+    Page* page = (Page*)base;
+    if (discard_page) {
+        discard(cache, page);
+        return;
+    }
+    page->pinned = false;
+    cache->pinned--;
+    (page->queue == A1in ? cache->in : cache->hot).push_front(page);
+    if (cache->purgeable) shrink_to(cache, cache->capacity);
+}
+
+void rekey(sqlite3_pcache* handle, sqlite3_pcache_page* base, unsigned old_key, unsigned new_key) {
+    Cache* cache = (Cache*)handle;
+    Page* page = (Page*)base;
+    auto existing = cache->pages.find(new_key);
+    if (existing != cache->pages.end()) discard(cache, existing->second);
+    cache->pages.erase(old_key);
+    forget_ghost(cache, new_key);
+    page->key = new_key;
+    cache->pages[new_key] = page;
+}
+
+void truncate(sqlite3_pcache* handle, unsigned limit) {
+    Cache* cache = (Cache*)handle;
+    std::vector<Page*> doomed;
+    for (const auto& entry : cache->pages)
+        if (entry.first >= limit) doomed.push_back(entry.second);
+    for (Page* page : doomed) discard(cache, page);
+}
+
+void destroy(sqlite3_pcache* handle) {
+    Cache* cache = (Cache*)handle;
+    {
+        Registry& shared = registry();
+        std::lock_guard<std::mutex> lock(shared.mutex);
+        shared.retired.hits += cache->counters.hits.load(std::memory_order_relaxed);
+        shared.retired.misses += cache->counters.misses.load(std::memory_order_relaxed);
+        shared.retired.evictions += cache->counters.evictions.load(std::memory_order_relaxed);
+        shared.retired.promotions += cache->counters.promotions.load(std::memory_order_relaxed);
+        shared.caches.erase(std::find(shared.caches.begin(), shared.caches.end(), cache));
+    }
+    for (const auto& entry : cache->pages) sqlite3_free(entry.second);
+    delete cache;
+}
+
+void shrink(sqlite3_pcache* handle) {
+    Cache* cache = (Cache*)handle;
+    if (cache->purgeable) shrink_to(cache, cache->pinned);
+}
+
+// Only succeeds before SQLite initializes.
+bool install() {
+    static const sqlite3_pcache_methods2 methods = {
+        1,        nullptr,    init,   shutdown, create, cache_size, page_count,
+        fetch,    unpin,      rekey,  truncate, destroy, shrink,
+    };
+    if (sqlite3_config(SQLITE_CONFIG_PCACHE2, &methods) != SQLITE_OK) return false;
+    installed = true;
+    return true;
+}
+
+} // namespace twoq
+
+PhasorValue sqlite_pcache_stats(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 0 || !twoq::installed) return phasor_make_null();
+
+    twoq::Registry& registry = twoq::registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    uint64_t hits = registry.retired.hits, misses = registry.retired.misses;
+    uint64_t evictions = registry.retired.evictions, promotions = registry.retired.promotions;
+    for (const twoq::Cache* cache : registry.caches) {
+        hits += cache->counters.hits.load(std::memory_order_relaxed);
+        misses += cache->counters.misses.load(std::memory_order_relaxed);
+        evictions += cache->counters.evictions.load(std::memory_order_relaxed);
+        promotions += cache->counters.promotions.load(std::memory_order_relaxed);
+    }
+    static thread_local PhasorValue stats[4];
+    stats[0] = phasor_make_int((int64_t)hits);
+    stats[1] = phasor_make_int((int64_t)misses);
+    stats[2] = phasor_make_int((int64_t)evictions);
+    stats[3] = phasor_make_int((int64_t)promotions);
+    return phasor_make_array(stats, 4);
+}
+
+// Process-wide memory settings from sqlite_configure.
+struct MemoryConfig {
+    std::mutex mutex;
+    int lookaside_size = 0;   // bytes per lookaside slot
+    int lookaside_slots = -1; // -1 keeps SQLite's default; 0 turns lookaside off
+    void* page_cache = nullptr; // slab handed to SQLITE_CONFIG_PAGECACHE
+    size_t page_cache_bytes = 0;
+    bool page_cache_mapped = false;
+};
+static MemoryConfig memory_config;
+
+// Gives a new connection the lookaside size chosen with sqlite_configure. Returns false if
+// SQLite refuses it.
+bool apply_lookaside(sqlite3* db) {
+    std::lock_guard<std::mutex> lock(memory_config.mutex);
+    if (memory_config.lookaside_slots < 0) return true;
+    return sqlite3_db_config(db, SQLITE_DBCONFIG_LOOKASIDE, nullptr, memory_config.lookaside_size,
+                             memory_config.lookaside_slots) == SQLITE_OK;
+}
+
+// Reserves the page cache slab, on huge pages when asked and the system has them reserved,
+// otherwise on normal pages with a transparent huge page hint.
+void* allocate_slab(size_t bytes, bool huge, bool* mapped) {
+    *mapped = false;
+#ifdef __linux__
+    if (huge) {
+        void* slab = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (slab == MAP_FAILED) {
+            slab = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (slab != MAP_FAILED) madvise(slab, bytes, MADV_HUGEPAGE);
+        }
+        if (slab != MAP_FAILED) {
+            *mapped = true;
+            return slab;
+        }
+    }
+#endif
+    return malloc(bytes);
+}
+
+void free_slab(void* slab, size_t bytes, bool mapped) {
+#ifdef __linux__
+    if (mapped) {
+        munmap(slab, bytes);
+        return;
+    }
+#endif
+    free(slab);
+}
+
+// Opens a connection with sqlite3_open_v2 and applies the startup pragmas. Returns nullptr on failure.
+sqlite3* open_connection(const char* filename, const OpenOptions& options) {
+    int flags = options.flags;
+    if (!(flags & (SQLITE_OPEN_READONLY | SQLITE_OPEN_READWRITE)))
+        flags |= SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+    if (sqlite3_strnicmp(filename, "file:", 5) == 0) flags |= SQLITE_OPEN_URI;
+
+    sqlite3* db = nullptr;
+    if (sqlite3_open_v2(filename, &db, flags, nullptr) != SQLITE_OK) {
+        sqlite3_close(db);
+        return nullptr;
+    }
+    if (!apply_lookaside(db) || !apply_open_pragmas(db, options)) {
+        sqlite3_close(db);
+        return nullptr;
+    }
+    return db;
+}
+
+PhasorValue sqlite_configure(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    std::vector<std::string> items;
+    if (argc != 1 || (!phasor_is_string(argv[0]) && !phasor_is_array(argv[0])) || !split_options(argv[0], items))
+        return phasor_make_bool(false);
+
+    int64_t page_size = 4096, pages = 0, lookaside_size = 1200, lookaside_slots = -1;
+    bool huge_pages = false, two_queue = false;
+    for (const std::string& item : items) {
+        if (sqlite3_stricmp(item.c_str(), "hugepages") == 0) {
+            huge_pages = true;
+            continue;
+        }
+        if (sqlite3_stricmp(item.c_str(), "pcache=2q") == 0) {
+            two_queue = true;
+            continue;
+        }
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) return phasor_make_bool(false);
+        std::string name = item.substr(0, eq);
+        std::string value = item.substr(eq + 1);
+        char* end = nullptr;
+        int64_t number = strtoll(value.c_str(), &end, 10);
+        if (value.empty() || *end || number < 0 || number > INT32_MAX) return phasor_make_bool(false);
+        if (sqlite3_stricmp(name.c_str(), "pagecache") == 0) pages = number;
+        else if (sqlite3_stricmp(name.c_str(), "pagecache_page_size") == 0) page_size = number;
+        else if (sqlite3_stricmp(name.c_str(), "lookaside") == 0) lookaside_slots = number;
+        else if (sqlite3_stricmp(name.c_str(), "lookaside_slot_size") == 0) lookaside_size = number;
+        else return phasor_make_bool(false);
+    }
+    if (page_size < 512 || page_size > 65536 || (page_size & (page_size - 1))) return phasor_make_bool(false);
+    if (huge_pages && !pages) return phasor_make_bool(false);
+    if (lookaside_size < 8 || lookaside_size > 65536) return phasor_make_bool(false);
+
+    std::lock_guard<std::mutex> lock(memory_config.mutex);
+    // The slab is only used by SQLite's built-in page cache.
+    if ((two_queue || twoq::installed) && (pages || memory_config.page_cache)) return phasor_make_bool(false);
+    if (two_queue && !twoq::install()) return phasor_make_bool(false);
+    if (pages) {
+        // Each slot holds a page plus the page cache's own header for it.
+        int header = 0;
+        sqlite3_config(SQLITE_CONFIG_PCACHE_HDRSZ, &header);
+        int64_t slot = (page_size + header + 7) & ~7;
+        size_t bytes = (size_t)(slot * pages);
+        if (huge_pages) bytes = (bytes + (2u << 20) - 1) & ~(size_t)((2u << 20) - 1);
+        if ((int64_t)(bytes / slot) > INT32_MAX) return phasor_make_bool(false);
+        bool mapped;
+        void* slab = allocate_slab(bytes, huge_pages, &mapped);
+        if (!slab) return phasor_make_bool(false);
+        // SQLite only accepts this before it initializes, which the first open does.
+        if (sqlite3_config(SQLITE_CONFIG_PAGECACHE, slab, (int)slot, (int)(bytes / slot)) != SQLITE_OK) {
+            free_slab(slab, bytes, mapped);
+            return phasor_make_bool(false);
+        }
+        if (memory_config.page_cache)
+            free_slab(memory_config.page_cache, memory_config.page_cache_bytes, memory_config.page_cache_mapped);
+        memory_config.page_cache = slab;
+        memory_config.page_cache_bytes = bytes;
+        memory_config.page_cache_mapped = mapped;
+    }
+    if (lookaside_slots >= 0) {
+        memory_config.lookaside_size = (int)lookaside_size;
+        memory_config.lookaside_slots = (int)lookaside_slots;
+    }
+    return phasor_make_bool(true);
+}
+
+PhasorValue sqlite_memory_stats(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 0) return phasor_make_null();
+    sqlite3_int64 used = 0, slab_used = 0, overflow = 0, highwater = 0;
+    sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &used, &highwater, 0);
+    sqlite3_status64(SQLITE_STATUS_PAGECACHE_USED, &slab_used, &highwater, 0);
+    sqlite3_status64(SQLITE_STATUS_PAGECACHE_OVERFLOW, &overflow, &highwater, 0);
+    static thread_local PhasorValue stats[3];
+    stats[0] = phasor_make_int(used);
+    stats[1] = phasor_make_int(slab_used);
+    stats[2] = phasor_make_int(overflow);
+    return phasor_make_array(stats, 3);
+}
+
+PhasorValue sqlite_lookaside_stats(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 1 || !phasor_is_int(argv[0])) return phasor_make_null();
+    sqlite3* db = get_db((int)phasor_to_int(argv[0]));
+    if (!db) return phasor_make_null();
+
+    // SQLite reports the hit and miss counts as high-water marks.
+    int used = 0, peak = 0, hits = 0, miss_size = 0, miss_full = 0, current = 0;
+    sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_USED, &used, &peak, 0);
+    sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_HIT, &current, &hits, 0);
+    sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE, &current, &miss_size, 0);
+    sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL, &current, &miss_full, 0);
+    static thread_local PhasorValue stats[4];
+    stats[0] = phasor_make_int(used);
+    stats[1] = phasor_make_int(peak);
+    stats[2] = phasor_make_int(hits);
+    stats[3] = phasor_make_int((int64_t)miss_size + miss_full);
+    return phasor_make_array(stats, 4);
+}
+
+PhasorValue sqlite_open_ex(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc < 1 || argc > 2 || !phasor_is_string(argv[0])) return phasor_make_null();
+    OpenOptions options;
+    if (argc == 2 && !parse_open_options(argv[1], options)) return phasor_make_null();
+
+    sqlite3* db = open_connection(phasor_to_string(argv[0]), options);
+    if (!db) return phasor_make_null();
+
+    int handle = register_connection(db);
+    return handle ? phasor_make_int(handle) : phasor_make_null();
+}
+
+PhasorValue sqlite_pool_open(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc < 2 || argc > 3 || !phasor_is_string(argv[0]) || !phasor_is_int(argv[1])) return phasor_make_null();
+    int64_t reader_count = phasor_to_int(argv[1]);
+    if (reader_count < 1 || reader_count > 256) return phasor_make_null();
+    OpenOptions options;
+    if (argc == 3 && !parse_open_options(argv[2], options)) return phasor_make_null();
+    if (options.flags & SQLITE_OPEN_READONLY) return phasor_make_null();
+
+    // Readers share the file through WAL, so the writer has to switch it over first.
+    const char* filename = phasor_to_string(argv[0]);
+    options.pragmas.emplace_back("journal_mode", "WAL");
+    sqlite3* writer = open_connection(filename, options);
+    if (!writer) return phasor_make_null();
+    const char* path = sqlite3_db_filename(writer, "main");
+    if (!path || !*path) { // in-memory and temporary databases cannot be shared
+        sqlite3_close(writer);
+        return phasor_make_null();
+    }
+
+    // Settings that only the writer may change are not repeated on the readers.
+    OpenOptions reader_options;
+    reader_options.flags = (options.flags & ~(SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE)) | SQLITE_OPEN_READONLY;
+    for (const auto& setting : options.pragmas) {
+        if (setting.first != "journal_mode" && setting.first != "page_size" &&
+            setting.first != "journal_size_limit" && setting.first != "wal_autocheckpoint")
+            reader_options.pragmas.push_back(setting);
+    }
+
+    Connection* conn = new Connection();
+    conn->db = writer;
+    for (int64_t i = 0; i < reader_count; i++) {
+        sqlite3* db = open_connection(filename, reader_options);
+        if (!db) break;
+        Connection* reader = new Connection();
+        reader->db = db;
+        conn->readers.push_back(reader);
+    }
+
+    int handle = (size_t)reader_count == conn->readers.size() ? db_table.insert(conn) : 0;
+    if (!handle) {
+        for (Connection* reader : conn->readers) {
+            sqlite3_close(reader->db);
+            delete reader;
+        }
+        sqlite3_close(writer);
+        delete conn;
+        return phasor_make_null();
+    }
+    return phasor_make_int(handle);
+}
+
+// Image of a database file read through a temporary connection inside one read transaction, so
+// it includes pages still in the WAL and never catches a writer halfway. The connection may
+// write so that SQLite can first roll back the hot journal a crashed writer left behind.
+unsigned char* serialize_database_file(const char* path, sqlite3_int64* size) {
+    OpenOptions options;
+    options.flags = SQLITE_OPEN_READWRITE; // without SQLITE_OPEN_CREATE, a missing file fails
+    sqlite3* db = open_connection(path, options);
+    if (!db) return nullptr;
+    unsigned char* data = sqlite3_serialize(db, "main", size, 0);
+    sqlite3_close(db);
+    return data;
+}
+
+// Opens a database image from sqlite3_malloc64 as a new in-memory connection that owns it.
+// The buffer is released on failure too.
+sqlite3* open_image(unsigned char* data, sqlite3_int64 size, bool readonly) {
+    // An in-memory database has no WAL, so the image is marked as a rollback-journal one.
+    data[18] = data[19] = 1;
+
+    sqlite3* db = nullptr;
+    if (sqlite3_open_v2(":memory:", &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) != SQLITE_OK) {
+        sqlite3_close(db);
+        sqlite3_free(data);
+        return nullptr;
+    }
+    if (!apply_lookaside(db)) {
+        sqlite3_close(db);
+        sqlite3_free(data);
+        return nullptr;
+    }
+    unsigned flags = SQLITE_DESERIALIZE_FREEONCLOSE | SQLITE_DESERIALIZE_RESIZEABLE;
+    if (readonly) flags |= SQLITE_DESERIALIZE_READONLY;
+    // sqlite3_deserialize takes ownership of the buffer even when it fails.
+    if (sqlite3_deserialize(db, "main", data, size, size, flags) != SQLITE_OK) {
+        sqlite3_close(db);
+        return nullptr;
+    }
+    return db;
+}
+
+PhasorValue sqlite_load_into_memory(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc < 1 || argc > 2 || !phasor_is_string(argv[0])) return phasor_make_null();
+    if (argc == 2 && !phasor_is_bool(argv[1])) return phasor_make_null();
+    const char* path = phasor_to_string(argv[0]);
+    bool readonly = argc == 2 && phasor_to_bool(argv[1]);
+
+    sqlite3_int64 size = 0;
+    unsigned char* data = serialize_database_file(path, &size);
+    if (!data || size < 100) {
+        sqlite3_free(data);
+        return phasor_make_null();
+    }
+
+    sqlite3* db = open_image(data, size, readonly);
+    if (!db) return phasor_make_null();
+    int handle = register_connection(db);
+    return handle ? phasor_make_int(handle) : phasor_make_null();
+}
+
+PhasorValue sqlite_clone(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 1 || !phasor_is_int(argv[0])) return phasor_make_null();
+    sqlite3* source = get_db((int)phasor_to_int(argv[0]));
+    if (!source) return phasor_make_null();
+
+    // A template loaded into memory is copied straight from its pages while the connection
+    // mutex keeps them still; any other database is serialized through its pager.
+    sqlite3_int64 size = 0;
+    unsigned char* data = nullptr;
+    sqlite3_mutex* mutex = sqlite3_db_mutex(source);
+    sqlite3_mutex_enter(mutex);
+    const unsigned char* pages = sqlite3_serialize(source, "main", &size, SQLITE_SERIALIZE_NOCOPY);
+    if (pages && size > 0 && (data = (unsigned char*)sqlite3_malloc64((sqlite3_uint64)size)))
+        memcpy(data, pages, (size_t)size);
+    sqlite3_mutex_leave(mutex);
+    if (!pages) data = sqlite3_serialize(source, "main", &size, 0);
+    if (!data || size < 100) {
+        sqlite3_free(data);
+        return phasor_make_null();
+    }
+
+    sqlite3* db = open_image(data, size, false);
+    if (!db) return phasor_make_null();
+    int handle = register_connection(db);
+    return handle ? phasor_make_int(handle) : phasor_make_null();
+}
+
+PhasorValue sqlite_snapshot_to_file(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 2 || !phasor_is_int(argv[0]) || !phasor_is_string(argv[1])) return phasor_make_bool(false);
+    sqlite3* db = get_db((int)phasor_to_int(argv[0]));
+    if (!db) return phasor_make_bool(false);
+    std::string path = phasor_to_string(argv[1]);
+    std::string temp = path + ".tmp";
+
+    FILE* file = fopen(temp.c_str(), "wb");
+    if (!file) return phasor_make_bool(false);
+
+    // An in-memory database is written straight from its own pages; the connection mutex keeps
+    // them from changing meanwhile. Any other database is copied out first.
+    bool ok;
+    sqlite3_int64 size = 0;
+    sqlite3_mutex* mutex = sqlite3_db_mutex(db);
+    sqlite3_mutex_enter(mutex);
+    unsigned char* data = sqlite3_serialize(db, "main", &size, SQLITE_SERIALIZE_NOCOPY);
+    if (data) {
+        ok = fwrite(data, 1, (size_t)size, file) == (size_t)size;
+        sqlite3_mutex_leave(mutex);
+    } else {
+        sqlite3_mutex_leave(mutex);
+        data = sqlite3_serialize(db, "main", &size, 0);
+        ok = data && fwrite(data, 1, (size_t)size, file) == (size_t)size;
+        sqlite3_free(data);
+    }
+    ok = fclose(file) == 0 && ok;
+
+    // Written under a temporary name and moved into place, so readers never see a partial file.
+    if (ok && rename(temp.c_str(), path.c_str()) != 0) {
+        remove(path.c_str());
+        ok = rename(temp.c_str(), path.c_str()) == 0;
+    }
+    if (!ok) remove(temp.c_str());
+    return phasor_make_bool(ok);
+}
+
+PhasorValue sqlite_close(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 1 || !phasor_is_int(argv[0])) return phasor_make_bool(false);
+
+    Connection* conn = db_table.remove((int)phasor_to_int(argv[0]));
+    if (conn) {
+        stop_write_queue(conn);
+        stop_checkpointer(conn);
+        {
+            std::lock_guard<std::mutex> lock(conn->batch.mutex);
+            commit_batch(conn);
+        }
+        stop_batch_timer(conn);
+        // Statements the script has not finalized yet keep the connections open until they are.
+        for (Connection* reader : conn->readers) {
+            resize_cache(reader, 0);
+            sqlite3_close_v2(reader->db);
+            delete reader;
+        }
+        resize_cache(conn, 0);
+        sqlite3_close_v2(conn->db);
+        delete conn;
+        return phasor_make_bool(true);
+    }
+    return phasor_make_bool(false);
+}
+
+// sqlite3_exec with automatic retries. SQL can hold several statements, so a retry is only
+// made while nothing has been changed yet; otherwise the earlier statements would run twice.
+int exec_with_retry(Connection* conn, const char* sql) {
+    sqlite3_int64 changes = sqlite3_total_changes64(conn->db);
+    return with_retry(
+        conn, conn->db, [&] { return sqlite3_exec(conn->db, sql, nullptr, nullptr, nullptr); },
+        [&] { return sqlite3_total_changes64(conn->db) == changes; });
+}
+
+PhasorValue sqlite_exec(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc < 2 || argc > 3 || !phasor_is_int(argv[0]) || !phasor_is_string(argv[1])) 
+        return phasor_make_bool(false);
+    if (argc == 3 && !phasor_is_bool(argv[2])) return phasor_make_bool(false);
+
+    int handle = (int)phasor_to_int(argv[0]);
+    const char* sql = phasor_to_string(argv[1]);
+    Connection* conn = get_connection(handle);
+    if (!conn) return phasor_make_bool(false);
+
+    if (write_queue_active(conn)) {
+        // The writer thread owns the transaction while the queue is on.
+        if (is_transaction_control(sql)) return phasor_make_bool(false);
+        std::string text = sql; // fire-and-forget jobs outlive the argument
+        sqlite3* db = conn->db;
+        int64_t timeout_ms = conn->timeout_ms.load(std::memory_order_relaxed);
+        int rc;
+        bool queued = enqueue_write(conn, [conn, db, text, timeout_ms] {
+            Deadline deadline(db, timeout_ms);
+            return exec_with_retry(conn, text.c_str());
+        }, argc == 3 ? (int)phasor_to_bool(argv[2]) : -1, false, &rc, timeout_ms > 0);
+        if (queued) return phasor_make_bool(rc == SQLITE_OK);
+    }
+
+    if (begins_transaction(sql)) batch_yield(conn);
+    else batch_before_write(conn, sql);
+    Deadline deadline(conn->db, conn->timeout_ms.load(std::memory_order_relaxed));
+    int rc = exec_with_retry(conn, sql);
+    if (rc == SQLITE_OK) rc = batch_after_write(conn, 1);
+    return phasor_make_bool(rc == SQLITE_OK);
+}
+
+PhasorValue sqlite_prepare(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc < 2 || argc > 3 || !phasor_is_int(argv[0]) || !phasor_is_string(argv[1])) return phasor_make_null();
+    int64_t prefetch_depth = 0;
+    if (argc == 3) {
+        if (!phasor_is_int(argv[2])) return phasor_make_null();
+        prefetch_depth = phasor_to_int(argv[2]);
+        if (prefetch_depth < 0 || prefetch_depth > 65536) return phasor_make_null();
+    }
+    int db_handle = (int)phasor_to_int(argv[0]);
+    const char* sql = phasor_to_string(argv[1]);
+    Connection* conn = get_connection(db_handle);
+    if (!conn) return phasor_make_null();
+    batch_expire(conn);
+
+    int reader;
+    sqlite3_stmt* stmt = acquire_routed(conn, sql, &reader);
+    if (!stmt) return phasor_make_null();
+
+    Statement* statement = new Statement();
+    statement->stmt = stmt;
+    statement->db_handle = db_handle;
+    statement->reader = reader;
+    statement->sql = sql;
+    // BEGIN and SAVEPOINT count as read-only to SQLite but still have to close a pending batch.
+    statement->begins_transaction = begins_transaction(sql);
+    statement->controls_transaction = is_transaction_control(sql);
+    statement->readonly = sqlite3_stmt_readonly(stmt) != 0 && !statement->begins_transaction;
+    // Prefetching a write would run it ahead of the script, so only reads are pipelined, and
+    // only on serialized connections: the producer thread steps the statement while the script
+    // may be using the same connection.
+    if (statement->readonly && sqlite3_db_mutex(sqlite3_db_handle(stmt)))
+        statement->prefetch_depth = (size_t)prefetch_depth;
+
+    int handle = stmt_table.insert(statement);
+    if (!handle) {
+        release_routed(conn, reader, statement->sql, stmt);
+        delete statement;
+        return phasor_make_null();
+    }
+    return phasor_make_int(handle);
+}
+
+PhasorValue sqlite_step(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 1 || !phasor_is_int(argv[0])) return phasor_make_null();
+    int handle = (int)phasor_to_int(argv[0]);
+    Statement* statement = get_statement(handle);
+    if (!statement) return phasor_make_null();
+
+    sqlite3_stmt* stmt = statement->stmt;
+    statement->batch_done = false;
+    int rc = step_statement(statement);
+    if (rc == SQLITE_ROW) return phasor_make_bool(true);
+    if (rc == SQLITE_DONE) {
+        // Leave the statement ready to be re-bound and run again.
+        sqlite3_reset(stmt);
+        return phasor_make_bool(false);
+    }
+    if (rc == SQLITE_INTERRUPT) return phasor_make_string(statement->timed_out ? "timeout" : "interrupted");
+    return phasor_make_null();
+}
+
+PhasorValue sqlite_column(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 2 || !phasor_is_int(argv[0]) || !phasor_is_int(argv[1])) return phasor_make_null();
+    int stmt_handle = (int)phasor_to_int(argv[0]);
+    int col_index = (int)phasor_to_int(argv[1]);
+    Statement* statement = get_statement(stmt_handle);
+    if (!statement) return phasor_make_null();
+
+    int count = sqlite3_column_count(statement->stmt);
+    if (col_index < 0 || col_index >= count) return phasor_make_null();
+
+    return row_value(statement, col_index);
+}
+
+// Registers a buffer handle; deletes the buffer and returns 0 if the table is full.
+int register_buffer(Buffer* buffer) {
+    int handle = buffer_table.insert(buffer);
+    if (!handle) delete buffer;
+    return handle;
+}
+
+PhasorValue sqlite_column_blob(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 2 || !phasor_is_int(argv[0]) || !phasor_is_int(argv[1])) return phasor_make_null();
+    Statement* statement = get_statement((int)phasor_to_int(argv[0]));
+    if (!statement) return phasor_make_null();
+    int col = (int)phasor_to_int(argv[1]);
+    if (col < 0 || col >= sqlite3_column_count(statement->stmt)) return phasor_make_null();
+
+    Buffer* buffer = new Buffer();
+    const PrefetchRow* row = prefetched_row(statement);
+    if (row) {
+        // SQLite has moved past a prefetched row, so its bytes are copied out of the ring.
+        PhasorValue value = (size_t)col < row->values.size() ? row->values[col] : phasor_make_null();
+        if (phasor_is_array(value)) {
+            for (size_t i = 0; i < value.as.a.count; i++)
+                buffer->owned.push_back((unsigned char)value.as.a.elements[i].as.i);
+        } else if (phasor_is_string(value)) {
+            const char* text = phasor_to_string(value);
+            buffer->owned.assign(text, text + strlen(text));
+        } else {
+            delete buffer;
+            return phasor_make_null();
+        }
+        buffer->data = buffer->owned.data();
+        buffer->size = buffer->owned.size();
+        int handle = register_buffer(buffer);
+        return handle ? phasor_make_int(handle) : phasor_make_null();
+    }
+
+    sqlite3_stmt* stmt = statement->stmt;
+    if (sqlite3_column_type(stmt, col) == SQLITE_NULL) {
+        delete buffer;
+        return phasor_make_null();
+    }
+    buffer->data = (const unsigned char*)sqlite3_column_blob(stmt, col);
+    buffer->size = (size_t)sqlite3_column_bytes(stmt, col);
+    int handle = register_buffer(buffer);
+    if (!handle) return phasor_make_null();
+    statement->views.push_back(handle);
+    return phasor_make_int(handle);
+}
+
+PhasorValue sqlite_next_row(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 1 || !phasor_is_int(argv[0])) return phasor_make_bool(false);
+    Statement* statement = get_statement((int)phasor_to_int(argv[0]));
+    if (!statement) return phasor_make_bool(false);
+
+    sqlite3_stmt* stmt = statement->stmt;
+    statement->batch_done = false;
+    int rc = step_statement(statement);
+    if (rc == SQLITE_DONE) {
+        sqlite3_reset(stmt);
+        return phasor_make_null();
+    }
+    if (rc != SQLITE_ROW) return phasor_make_bool(false);
+
+    const PrefetchRow* prefetched = prefetched_row(statement);
+    if (prefetched) return phasor_make_array(prefetched->values.data(), prefetched->values.size());
+
+    int count = sqlite3_data_count(stmt);
+    statement->row.resize(count);
+    statement->row_bytes.clear();
+    for (int i = 0; i < count; i++) statement->row[i] = column_value(stmt, i, &statement->row_bytes);
+    for (PhasorValue& value : statement->row) pin_blob(value, statement->row_bytes);
+    return phasor_make_array(statement->row.data(), statement->row.size());
+}
+
+// Largest batch sqlite_fetch_many returns.
+static const int64_t fetch_many_limit = 1 << 20;
+
+PhasorValue sqlite_fetch_many(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 2 || !phasor_is_int(argv[0]) || !phasor_is_int(argv[1])) return phasor_make_bool(false);
+    // Out of range is an error rather than null, which means the rows have run out.
+    if (phasor_to_int(argv[1]) <= 0 || phasor_to_int(argv[1]) > fetch_many_limit) return phasor_make_bool(false);
+    Statement* statement = get_statement((int)phasor_to_int(argv[0]));
+    if (!statement) return phasor_make_bool(false);
+
+    sqlite3_stmt* stmt = statement->stmt;
+    if (statement->batch_done) {
+        statement->batch_done = false;
+        return phasor_make_null();
+    }
+
+    size_t max_rows = (size_t)phasor_to_int(argv[1]);
+    size_t cols = (size_t)sqlite3_column_count(stmt);
+    std::vector<std::vector<PhasorValue>>& cells = statement->batch_cells;
+    std::vector<char>& text = statement->batch_text;
+    std::vector<PhasorValue>& bytes = statement->batch_bytes;
+    cells.resize(cols);
+    for (auto& column : cells) column.clear();
+    text.clear();
+    bytes.clear();
+
+    // Text is copied into one arena since SQLite's buffers do not survive the next step.
+    // Cells hold arena offsets until the batch is complete and the arena can no longer move.
+    size_t rows = 0;
+    int rc = SQLITE_ROW;
+    while (rows < max_rows && (rc = step_statement(statement)) == SQLITE_ROW) {
+        for (size_t c = 0; c < cols; c++) {
+            cells[c].push_back(row_value(statement, (int)c));
+            PhasorValue& cell = cells[c].back();
+            if (phasor_is_string(cell)) {
+                const char* value = phasor_to_string(cell);
+                size_t len = strlen(value);
+                cell.as.i = (int64_t)text.size();
+                text.insert(text.end(), value, value + len);
+                text.push_back('\0');
+            } else if (phasor_is_array(cell)) {
+                const PhasorValue* blob = cell.as.a.elements;
+                cell.as.a.elements = (const PhasorValue*)(uintptr_t)bytes.size();
+                bytes.insert(bytes.end(), blob, blob + cell.as.a.count);
+            }
+        }
+        rows++;
+    }
+
+    if (rc == SQLITE_DONE) {
+        sqlite3_reset(stmt);
+        statement->batch_done = rows > 0;
+    } else if (rc != SQLITE_ROW && rows == 0) {
+        return phasor_make_bool(false);
+    }
+    if (rows == 0) return phasor_make_null();
+
+    statement->batch_columns.resize(cols);
+    for (size_t c = 0; c < cols; c++) {
+        PhasorValue* column = cells[c].data();
+        for (size_t r = 0; r < rows; r++) {
+            if (phasor_is_string(column[r])) column[r].as.s = text.data() + column[r].as.i;
+            pin_blob(column[r], bytes);
+        }
+        statement->batch_columns[c] = phasor_make_array(column, rows);
+    }
+    return phasor_make_array(statement->batch_columns.data(), cols);
+}
+
+PhasorValue sqlite_reset(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 1 || !phasor_is_int(argv[0])) return phasor_make_bool(false);
+    Statement* statement = get_statement((int)phasor_to_int(argv[0]));
+    if (!statement) return phasor_make_bool(false);
+
+    // The return code only repeats the error from the last step; the statement is reset either way.
+    stop_prefetch(statement);
+    release_views(statement);
+    sqlite3_reset(statement->stmt);
+    statement->batch_done = false;
+    statement->aborted = false;
+    return phasor_make_bool(true);
+}
+
+PhasorValue sqlite_clear_bindings(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 1 || !phasor_is_int(argv[0])) return phasor_make_bool(false);
+    sqlite3_stmt* stmt = get_stmt((int)phasor_to_int(argv[0]));
+    if (!stmt) return phasor_make_bool(false);
+    return phasor_make_bool(sqlite3_clear_bindings(stmt) == SQLITE_OK);
+}
+
+// Reads an array of ints in 0..255 into `bytes`.
+bool array_bytes(const PhasorValue& value, std::vector<unsigned char>& bytes) {
+    bytes.resize(value.as.a.count);
+    for (size_t i = 0; i < value.as.a.count; i++) {
+        const PhasorValue& byte = value.as.a.elements[i];
+        if (!phasor_is_int(byte) || byte.as.i < 0 || byte.as.i > 255) return false;
+        bytes[i] = (unsigned char)byte.as.i;
+    }
+    return true;
+}
+
+int bind_bytes(sqlite3_stmt* stmt, int index, const unsigned char* data, size_t size) {
+    // A null pointer would bind NULL rather than an empty BLOB.
+    if (size == 0) return sqlite3_bind_zeroblob(stmt, index, 0);
+    return sqlite3_bind_blob64(stmt, index, data, size, SQLITE_TRANSIENT);
+}
+
+int bind_value(sqlite3_stmt* stmt, int index, const PhasorValue& value) {
+    switch (value.type) {
+    case PHASOR_TYPE_NULL:   return sqlite3_bind_null(stmt, index);
+    case PHASOR_TYPE_BOOL:   return sqlite3_bind_int64(stmt, index, phasor_to_bool(value) ? 1 : 0);
+    case PHASOR_TYPE_INT:    return sqlite3_bind_int64(stmt, index, phasor_to_int(value));
+    case PHASOR_TYPE_FLOAT:  return sqlite3_bind_double(stmt, index, phasor_to_float(value));
+    case PHASOR_TYPE_STRING: return sqlite3_bind_text(stmt, index, phasor_to_string(value), -1, SQLITE_TRANSIENT);
+    case PHASOR_TYPE_ARRAY: {
+        static thread_local std::vector<unsigned char> bytes;
+        if (!array_bytes(value, bytes)) return SQLITE_MISMATCH;
+        return bind_bytes(stmt, index, bytes.data(), bytes.size());
+    }
+    default: return SQLITE_MISMATCH;
+    }
+}
+
+int find_parameter(sqlite3_stmt* stmt, const char* name) {
+    int index = sqlite3_bind_parameter_index(stmt, name);
+    if (index > 0 || name[0] == ':' || name[0] == '@' || name[0] == '$') return index;
+
+    // Allow callers to omit the prefix character used in the SQL text.
+    std::string prefixed = std::string(":") + name;
+    for (char prefix : {':', '@', '$'}) {
+        prefixed[0] = prefix;
+        index = sqlite3_bind_parameter_index(stmt, prefixed.c_str());
+        if (index > 0) return index;
+    }
+    return 0;
+}
+
+PhasorValue sqlite_bind(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 3 || !phasor_is_int(argv[0]) || !phasor_is_int(argv[1])) return phasor_make_bool(false);
+    sqlite3_stmt* stmt = get_stmt((int)phasor_to_int(argv[0]));
+    if (!stmt) return phasor_make_bool(false);
+    return phasor_make_bool(bind_value(stmt, (int)phasor_to_int(argv[1]), argv[2]) == SQLITE_OK);
+}
+
+PhasorValue sqlite_bind_int(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 3 || !phasor_is_int(argv[0]) || !phasor_is_int(argv[1]) || !phasor_is_int(argv[2]))
+        return phasor_make_bool(false);
+    sqlite3_stmt* stmt = get_stmt((int)phasor_to_int(argv[0]));
+    if (!stmt) return phasor_make_bool(false);
+    return phasor_make_bool(sqlite3_bind_int64(stmt, (int)phasor_to_int(argv[1]), phasor_to_int(argv[2])) == SQLITE_OK);
+}
+
+PhasorValue sqlite_bind_float(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 3 || !phasor_is_int(argv[0]) || !phasor_is_int(argv[1]) || !phasor_is_number(argv[2]))
+        return phasor_make_bool(false);
+    sqlite3_stmt* stmt = get_stmt((int)phasor_to_int(argv[0]));
+    if (!stmt) return phasor_make_bool(false);
+    return phasor_make_bool(sqlite3_bind_double(stmt, (int)phasor_to_int(argv[1]), phasor_to_float(argv[2])) == SQLITE_OK);
+}
+
+PhasorValue sqlite_bind_text(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 3 || !phasor_is_int(argv[0]) || !phasor_is_int(argv[1]) || !phasor_is_string(argv[2]))
+        return phasor_make_bool(false);
+    sqlite3_stmt* stmt = get_stmt((int)phasor_to_int(argv[0]));
+    if (!stmt) return phasor_make_bool(false);
+    int rc = sqlite3_bind_text(stmt, (int)phasor_to_int(argv[1]), phasor_to_string(argv[2]), -1, SQLITE_TRANSIENT);
+    return phasor_make_bool(rc == SQLITE_OK);
+}
+
+PhasorValue sqlite_bind_null(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 2 || !phasor_is_int(argv[0]) || !phasor_is_int(argv[1])) return phasor_make_bool(false);
+    sqlite3_stmt* stmt = get_stmt((int)phasor_to_int(argv[0]));
+    if (!stmt) return phasor_make_bool(false);
+    return phasor_make_bool(sqlite3_bind_null(stmt, (int)phasor_to_int(argv[1])) == SQLITE_OK);
+}
+
+PhasorValue sqlite_bind_named(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 3 || !phasor_is_int(argv[0]) || !phasor_is_string(argv[1])) return phasor_make_bool(false);
+    sqlite3_stmt* stmt = get_stmt((int)phasor_to_int(argv[0]));
+    if (!stmt) return phasor_make_bool(false);
+
+    int index = find_parameter(stmt, phasor_to_string(argv[1]));
+    if (index == 0) return phasor_make_bool(false);
+    return phasor_make_bool(bind_value(stmt, index, argv[2]) == SQLITE_OK);
+}
+
+PhasorValue sqlite_bind_blob(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 3 || !phasor_is_int(argv[0]) || !phasor_is_int(argv[1])) return phasor_make_bool(false);
+    if (phasor_is_array(argv[2])) return sqlite_bind(vm, argc, argv);
+    if (!phasor_is_int(argv[2])) return phasor_make_bool(false);
+
+    Buffer* buffer = buffer_table.get((int)phasor_to_int(argv[2]));
+    sqlite3_stmt* stmt = get_stmt((int)phasor_to_int(argv[0]));
+    if (!buffer || !stmt) return phasor_make_bool(false);
+    return phasor_make_bool(bind_bytes(stmt, (int)phasor_to_int(argv[1]), buffer->data, buffer->size) == SQLITE_OK);
+}
+
+PhasorValue sqlite_buffer_new(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 1) return phasor_make_null();
+    Buffer* buffer = new Buffer();
+    if (phasor_is_string(argv[0])) {
+        const char* text = phasor_to_string(argv[0]);
+        buffer->owned.assign(text, text + strlen(text));
+    } else if (!phasor_is_array(argv[0]) || !array_bytes(argv[0], buffer->owned)) {
+        delete buffer;
+        return phasor_make_null();
+    }
+    buffer->data = buffer->owned.data();
+    buffer->size = buffer->owned.size();
+    int handle = register_buffer(buffer);
+    return handle ? phasor_make_int(handle) : phasor_make_null();
+}
+
+PhasorValue sqlite_buffer_copy(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 1 || !phasor_is_int(argv[0])) return phasor_make_null();
+    Buffer* source = buffer_table.get((int)phasor_to_int(argv[0]));
+    if (!source) return phasor_make_null();
+
+    Buffer* buffer = new Buffer();
+    buffer->owned.assign(source->data, source->data + source->size);
+    buffer->data = buffer->owned.data();
+    buffer->size = buffer->owned.size();
+    int handle = register_buffer(buffer);
+    return handle ? phasor_make_int(handle) : phasor_make_null();
+}
+
+PhasorValue sqlite_buffer_size(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 1 || !phasor_is_int(argv[0])) return phasor_make_null();
+    Buffer* buffer = buffer_table.get((int)phasor_to_int(argv[0]));
+    return buffer ? phasor_make_int((int64_t)buffer->size) : phasor_make_null();
+}
+
+PhasorValue sqlite_buffer_read(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc < 1 || argc > 3) return phasor_make_null();
+    for (int i = 0; i < argc; i++) {
+        if (!phasor_is_int(argv[i])) return phasor_make_null();
+    }
+    Buffer* buffer = buffer_table.get((int)phasor_to_int(argv[0]));
+    if (!buffer) return phasor_make_null();
+
+    int64_t offset = argc > 1 ? phasor_to_int(argv[1]) : 0;
+    if (offset < 0 || (uint64_t)offset > buffer->size) return phasor_make_null();
+    size_t count = buffer->size - (size_t)offset;
+    if (argc > 2) {
+        if (phasor_to_int(argv[2]) < 0) return phasor_make_null();
+        count = std::min(count, (size_t)phasor_to_int(argv[2]));
+    }
+
+    static thread_local std::vector<PhasorValue> bytes;
+    bytes.resize(count);
+    for (size_t i = 0; i < count; i++) bytes[i] = phasor_make_int(buffer->data[offset + i]);
+    return phasor_make_array(bytes.data(), count);
+}
+
+PhasorValue sqlite_bind_zeroblob(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 3 || !phasor_is_int(argv[0]) || !phasor_is_int(argv[1]) || !phasor_is_int(argv[2]) ||
+        phasor_to_int(argv[2]) < 0)
+        return phasor_make_bool(false);
+    sqlite3_stmt* stmt = get_stmt((int)phasor_to_int(argv[0]));
+    if (!stmt) return phasor_make_bool(false);
+    int rc = sqlite3_bind_zeroblob64(stmt, (int)phasor_to_int(argv[1]), (sqlite3_uint64)phasor_to_int(argv[2]));
+    return phasor_make_bool(rc == SQLITE_OK);
+}
+
+PhasorValue sqlite_buffer_free(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 1 || !phasor_is_int(argv[0])) return phasor_make_bool(false);
+    int handle = (int)phasor_to_int(argv[0]);
+    Buffer* buffer = buffer_table.remove(handle);
+    if (!buffer) return phasor_make_bool(false);
+    // A view freed early is simply skipped when its statement moves on.
+    delete buffer;
+    return phasor_make_bool(true);
+}
+
+PhasorValue sqlite_finalize(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 1 || !phasor_is_int(argv[0])) return phasor_make_bool(false);
+
+    Statement* statement = stmt_table.remove((int)phasor_to_int(argv[0]));
+    if (statement) {
+        stop_prefetch(statement);
+        release_views(statement);
+        Connection* conn = get_connection(statement->db_handle);
+        if (conn) release_routed(conn, statement->reader, statement->sql, statement->stmt);
+        else sqlite3_finalize(statement->stmt);
+        delete statement;
+        return phasor_make_bool(true);
+    }
+    return phasor_make_bool(false);
+}
+
+PhasorValue sqlite_query(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc < 2 || !phasor_is_int(argv[0]) || !phasor_is_string(argv[1])) return phasor_make_bool(false);
+    Connection* conn = get_connection((int)phasor_to_int(argv[0]));
+    if (!conn) return phasor_make_bool(false);
+    batch_expire(conn);
+
+    std::string sql = phasor_to_string(argv[1]);
+    int reader;
+    sqlite3_stmt* stmt = acquire_routed(conn, sql.c_str(), &reader);
+    if (!stmt) return phasor_make_bool(false);
+
+    for (int i = 2; i < argc; i++) {
+        if (bind_value(stmt, i - 1, argv[i]) != SQLITE_OK) {
+            release_routed(conn, reader, sql, stmt);
+            return phasor_make_bool(false);
+        }
+    }
+
+    // The statement is reset before returning, so text is copied out first.
+    static thread_local std::string text_result;
+    static thread_local std::vector<PhasorValue> bytes_result;
+    // A queued write runs on the writer thread, so it must fill this thread's buffers.
+    std::string& text = text_result;
+    std::vector<PhasorValue>& bytes = bytes_result;
+    PhasorValue result = phasor_make_null();
+    int64_t timeout_ms = conn->timeout_ms.load(std::memory_order_relaxed);
+    auto run = [&] {
+        Deadline deadline(sqlite3_db_handle(stmt), timeout_ms);
+        int rc = sqlite3_step(stmt);
+        if (rc == SQLITE_ROW && sqlite3_column_count(stmt) > 0) {
+            bytes.clear();
+            result = column_value(stmt, 0, &bytes);
+            pin_blob(result, bytes);
+            if (phasor_is_string(result)) {
+                text = phasor_to_string(result);
+                result = phasor_make_string(text.c_str());
+            }
+        }
+        // Finish the statement here so a queued write can be released and committed.
+        sqlite3_reset(stmt);
+        return rc == SQLITE_ROW || rc == SQLITE_DONE ? SQLITE_OK : rc;
+    };
+
+    int rc;
+    bool write = !sqlite3_stmt_readonly(stmt);
+    bool queued = false;
+    if (write_queue_active(conn)) {
+        if (is_transaction_control(sql.c_str())) {
+            release_routed(conn, reader, sql, stmt);
+            return phasor_make_bool(false);
+        }
+        if (write) queued = enqueue_write(conn, run, -1, true, &rc, timeout_ms > 0);
+    }
+    if (!queued) {
+        if (write) batch_before_write(conn);
+        rc = run();
+        if (write) {
+            int commit_rc = batch_after_write(conn, rc == SQLITE_OK ? 1 : 0);
+            if (rc == SQLITE_OK) rc = commit_rc;
+        }
+    }
+    if (rc != SQLITE_OK) result = phasor_make_bool(false);
+
+    release_routed(conn, reader, sql, stmt);
+    return result;
+}
+
+PhasorValue sqlite_exec_many(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 3 || !phasor_is_int(argv[0]) || !phasor_is_string(argv[1]) || !phasor_is_array(argv[2]))
+        return phasor_make_bool(false);
+    Connection* conn = get_connection((int)phasor_to_int(argv[0]));
+    if (!conn) return phasor_make_bool(false);
+
+    std::string sql = phasor_to_string(argv[1]);
+    sqlite3_stmt* stmt = acquire_statement(conn, sql.c_str());
+    if (!stmt) return phasor_make_bool(false);
+
+    const PhasorValue* rows = argv[2].as.a.elements;
+    size_t row_count = argv[2].as.a.count;
+    int64_t changes = 0;
+    int64_t timeout_ms = conn->timeout_ms.load(std::memory_order_relaxed);
+    auto run = [&] {
+        // The limit covers the whole call rather than each row.
+        Deadline deadline(conn->db, timeout_ms);
+        // A savepoint starts a transaction when none is open and nests inside the script's, the
+        // batcher's or the write queue's otherwise, so a failing row undoes exactly this call.
+        if (run_cached(conn, "SAVEPOINT exec_many") != SQLITE_OK) return SQLITE_ERROR;
+        bool ok = true;
+        for (size_t r = 0; ok && r < row_count; r++) {
+            const PhasorValue& row = rows[r];
+            // A scalar row is shorthand for a single-parameter statement.
+            const PhasorValue* values = phasor_is_array(row) ? row.as.a.elements : &row;
+            size_t value_count = phasor_is_array(row) ? row.as.a.count : 1;
+
+            for (size_t i = 0; ok && i < value_count; i++)
+                ok = bind_value(stmt, (int)i + 1, values[i]) == SQLITE_OK;
+            ok = ok && sqlite3_step(stmt) == SQLITE_DONE;
+            if (ok) changes += sqlite3_changes64(conn->db);
+
+            sqlite3_reset(stmt);
+            sqlite3_clear_bindings(stmt);
+        }
+        // Some errors roll back the whole transaction, savepoint included.
+        if (!sqlite3_get_autocommit(conn->db)) {
+            if (ok && run_cached(conn, "RELEASE exec_many") != SQLITE_OK) ok = false;
+            if (!ok && !sqlite3_get_autocommit(conn->db)) {
+                run_cached(conn, "ROLLBACK TO exec_many");
+                run_cached(conn, "RELEASE exec_many");
+            }
+        }
+        return ok ? SQLITE_OK : SQLITE_ERROR;
+    };
+
+    int rc;
+    if (write_queue_active(conn) && enqueue_write(conn, run, -1, true, &rc, timeout_ms > 0)) {
+        release_statement(conn, sql, stmt);
+        return rc == SQLITE_OK ? phasor_make_int(changes) : phasor_make_bool(false);
+    }
+
+    batch_before_write(conn);
+    bool ok = run() == SQLITE_OK;
+    release_statement(conn, sql, stmt);
+    if (batch_after_write(conn, ok ? (int64_t)row_count : 0) != SQLITE_OK) ok = false;
+    return ok ? phasor_make_int(changes) : phasor_make_bool(false);
 }
 
-int store_string(const char* s) {
-    std::lock_guard<std::mutex> lock(string_mutex);
-    size_t len = strlen(s);
-    char* copy = (char*)malloc(len + 1);
-    memcpy(copy, s, len + 1);
+PhasorValue sqlite_blob_open(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 5 || !phasor_is_int(argv[0]) || !phasor_is_string(argv[1]) || !phasor_is_string(argv[2]) ||
+        !phasor_is_int(argv[3]) || !phasor_is_bool(argv[4]))
+        return phasor_make_null();
+    sqlite3* db = get_db((int)phasor_to_int(argv[0]));
+    if (!db) return phasor_make_null();
 
-    int handle = next_string_handle++;
-    string_table[handle] = copy;
-    return handle;
+    sqlite3_blob* handle = nullptr;
+    bool writable = phasor_to_bool(argv[4]);
+    if (sqlite3_blob_open(db, "main", phasor_to_string(argv[1]), phasor_to_string(argv[2]),
+                          phasor_to_int(argv[3]), writable ? 1 : 0, &handle) != SQLITE_OK) {
+        // A failed open may still hand back a handle that has to be closed.
+        sqlite3_blob_close(handle);
+        return phasor_make_null();
+    }
+
+    Blob* blob = new Blob();
+    blob->blob = handle;
+    blob->writable = writable;
+    int id = blob_table.insert(blob);
+    if (!id) {
+        sqlite3_blob_close(handle);
+        delete blob;
+        return phasor_make_null();
+    }
+    return phasor_make_int(id);
+}
+
+PhasorValue sqlite_blob_bytes(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 1 || !phasor_is_int(argv[0])) return phasor_make_null();
+    Blob* blob = blob_table.get((int)phasor_to_int(argv[0]));
+    return blob ? phasor_make_int(sqlite3_blob_bytes(blob->blob)) : phasor_make_null();
 }
 
-const char* get_string(int handle) {
-    std::lock_guard<std::mutex> lock(string_mutex);
-    auto it = string_table.find(handle);
-    return it != string_table.end() ? it->second : nullptr;
+PhasorValue sqlite_blob_read(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 3 || !phasor_is_int(argv[0]) || !phasor_is_int(argv[1]) || !phasor_is_int(argv[2]))
+        return phasor_make_null();
+    Blob* blob = blob_table.get((int)phasor_to_int(argv[0]));
+    if (!blob) return phasor_make_null();
+
+    int64_t size = sqlite3_blob_bytes(blob->blob);
+    int64_t offset = phasor_to_int(argv[1]);
+    int64_t count = phasor_to_int(argv[2]);
+    if (offset < 0 || offset > size || count < 0) return phasor_make_null();
+    // A chunk running past the end is cut short, so a fixed chunk size reads the whole value.
+    count = std::min(count, size - offset);
+
+    static thread_local std::vector<unsigned char> chunk;
+    static thread_local std::vector<PhasorValue> bytes;
+    chunk.resize((size_t)count);
+    if (count > 0 && sqlite3_blob_read(blob->blob, chunk.data(), (int)count, (int)offset) != SQLITE_OK)
+        return phasor_make_null();
+    bytes.resize((size_t)count);
+    for (size_t i = 0; i < (size_t)count; i++) bytes[i] = phasor_make_int(chunk[i]);
+    return phasor_make_array(bytes.data(), bytes.size());
 }
 
-void free_string(int handle) {
-    std::lock_guard<std::mutex> lock(string_mutex);
-    auto it = string_table.find(handle);
-    if (it != string_table.end()) {
-        free(it->second);
-        string_table.erase(it);
+PhasorValue sqlite_blob_write(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 3 || !phasor_is_int(argv[0]) || !phasor_is_int(argv[1]) || phasor_to_int(argv[1]) < 0)
+        return phasor_make_bool(false);
+    Blob* blob = blob_table.get((int)phasor_to_int(argv[0]));
+    if (!blob || !blob->writable) return phasor_make_bool(false);
+
+    // Data comes from a buffer handle or an array of byte values; the BLOB cannot grow, so
+    // writes past its end fail.
+    static thread_local std::vector<unsigned char> bytes;
+    const unsigned char* data;
+    size_t size;
+    if (phasor_is_int(argv[2])) {
+        Buffer* buffer = buffer_table.get((int)phasor_to_int(argv[2]));
+        if (!buffer) return phasor_make_bool(false);
+        data = buffer->data;
+        size = buffer->size;
+    } else if (phasor_is_array(argv[2]) && array_bytes(argv[2], bytes)) {
+        data = bytes.data();
+        size = bytes.size();
+    } else {
+        return phasor_make_bool(false);
     }
+    if (size == 0) return phasor_make_bool(true);
+    if (size > (size_t)INT32_MAX || phasor_to_int(argv[1]) > INT32_MAX) return phasor_make_bool(false);
+    int rc = sqlite3_blob_write(blob->blob, data, (int)size, (int)phasor_to_int(argv[1]));
+    return phasor_make_bool(rc == SQLITE_OK);
 }
 
-PhasorValue sqlite_open(PhasorVM* vm, int argc, const PhasorValue* argv) {
-    if (argc != 1 || !phasor_is_string(argv[0])) return phasor_make_null();
-    const char* filename = phasor_to_string(argv[0]);
-    sqlite3* db = nullptr;
-    if (sqlite3_open(filename, &db) != SQLITE_OK) { sqlite3_close(db); return phasor_make_null(); }
+PhasorValue sqlite_blob_reopen(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 2 || !phasor_is_int(argv[0]) || !phasor_is_int(argv[1])) return phasor_make_bool(false);
+    Blob* blob = blob_table.get((int)phasor_to_int(argv[0]));
+    if (!blob) return phasor_make_bool(false);
+    // On failure SQLite aborts the handle; later reads and writes fail until a reopen succeeds.
+    return phasor_make_bool(sqlite3_blob_reopen(blob->blob, phasor_to_int(argv[1])) == SQLITE_OK);
+}
 
-    std::lock_guard<std::mutex> lock(db_mutex);
-    int handle = next_db_handle++;
-    db_table[handle] = db;
-    return phasor_make_int(handle);
+PhasorValue sqlite_blob_close(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 1 || !phasor_is_int(argv[0])) return phasor_make_bool(false);
+    Blob* blob = blob_table.remove((int)phasor_to_int(argv[0]));
+    if (!blob) return phasor_make_bool(false);
+    int rc = sqlite3_blob_close(blob->blob);
+    delete blob;
+    return phasor_make_bool(rc == SQLITE_OK);
 }
 
-PhasorValue sqlite_close(PhasorVM* vm, int argc, const PhasorValue* argv) {
+PhasorValue sqlite_begin(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc < 1 || argc > 2 || !phasor_is_int(argv[0])) return phasor_make_bool(false);
+    Connection* conn = get_connection((int)phasor_to_int(argv[0]));
+    if (!conn || write_queue_active(conn)) return phasor_make_bool(false);
+
+    const char* sql = "BEGIN";
+    if (argc == 2) {
+        if (!phasor_is_string(argv[1])) return phasor_make_bool(false);
+        const char* mode = phasor_to_string(argv[1]);
+        if (sqlite3_stricmp(mode, "deferred") == 0) sql = "BEGIN DEFERRED";
+        else if (sqlite3_stricmp(mode, "immediate") == 0) sql = "BEGIN IMMEDIATE";
+        else if (sqlite3_stricmp(mode, "exclusive") == 0) sql = "BEGIN EXCLUSIVE";
+        else return phasor_make_bool(false);
+    }
+
+    // An explicit transaction takes over from any pending batch.
+    std::lock_guard<std::mutex> lock(conn->batch.mutex);
+    if (commit_batch(conn) != SQLITE_OK) return phasor_make_bool(false);
+    return phasor_make_bool(run_cached(conn, sql) == SQLITE_OK);
+}
+
+PhasorValue sqlite_commit(PhasorVM* vm, int argc, const PhasorValue* argv) {
     if (argc != 1 || !phasor_is_int(argv[0])) return phasor_make_bool(false);
+    Connection* conn = get_connection((int)phasor_to_int(argv[0]));
+    if (!conn || write_queue_active(conn)) return phasor_make_bool(false);
 
-    int handle = (int)phasor_to_int(argv[0]);
-    sqlite3* db = nullptr;
+    std::lock_guard<std::mutex> lock(conn->batch.mutex);
+    if (run_cached(conn, "COMMIT") != SQLITE_OK) return phasor_make_bool(false);
+    conn->batch.open = false;
+    return phasor_make_bool(true);
+}
+
+PhasorValue sqlite_rollback(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc < 1 || argc > 2 || !phasor_is_int(argv[0])) return phasor_make_bool(false);
+    Connection* conn = get_connection((int)phasor_to_int(argv[0]));
+    if (!conn || write_queue_active(conn)) return phasor_make_bool(false);
+
+    if (argc == 2) {
+        if (!phasor_is_string(argv[1]) || !valid_identifier(phasor_to_string(argv[1]))) return phasor_make_bool(false);
+        return phasor_make_bool(run_cached(conn, std::string("ROLLBACK TO ") + phasor_to_string(argv[1])) == SQLITE_OK);
+    }
+
+    std::lock_guard<std::mutex> lock(conn->batch.mutex);
+    if (run_cached(conn, "ROLLBACK") != SQLITE_OK) return phasor_make_bool(false);
+    conn->batch.open = false;
+    return phasor_make_bool(true);
+}
+
+PhasorValue sqlite_savepoint(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 2 || !phasor_is_int(argv[0]) || !phasor_is_string(argv[1])) return phasor_make_bool(false);
+    Connection* conn = get_connection((int)phasor_to_int(argv[0]));
+    if (!conn || write_queue_active(conn) || !valid_identifier(phasor_to_string(argv[1]))) return phasor_make_bool(false);
+
+    // Like BEGIN, the savepoint takes over from a pending batch rather than nesting inside it.
+    std::lock_guard<std::mutex> lock(conn->batch.mutex);
+    if (commit_batch(conn) != SQLITE_OK) return phasor_make_bool(false);
+    return phasor_make_bool(run_cached(conn, std::string("SAVEPOINT ") + phasor_to_string(argv[1])) == SQLITE_OK);
+}
+
+PhasorValue sqlite_release(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 2 || !phasor_is_int(argv[0]) || !phasor_is_string(argv[1])) return phasor_make_bool(false);
+    Connection* conn = get_connection((int)phasor_to_int(argv[0]));
+    if (!conn || write_queue_active(conn) || !valid_identifier(phasor_to_string(argv[1]))) return phasor_make_bool(false);
+    return phasor_make_bool(run_cached(conn, std::string("RELEASE ") + phasor_to_string(argv[1])) == SQLITE_OK);
+}
+
+PhasorValue sqlite_autobatch(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 3 || !phasor_is_int(argv[0]) || !phasor_is_int(argv[1]) || !phasor_is_int(argv[2]))
+        return phasor_make_bool(false);
+    int64_t max_writes = phasor_to_int(argv[1]);
+    int64_t max_ms = phasor_to_int(argv[2]);
+    if (max_writes < 0 || max_ms < 0) return phasor_make_bool(false);
+    Connection* conn = get_connection((int)phasor_to_int(argv[0]));
+    if (!conn || write_queue_active(conn)) return phasor_make_bool(false);
+
+    AutoBatch& batch = conn->batch;
+    std::lock_guard<std::mutex> lock(batch.mutex);
+    batch.enabled = max_writes > 0 || max_ms > 0;
+    batch.max_writes = max_writes;
+    batch.max_ms = max_ms;
+    // The timer stays idle while no batch is open and is stopped by sqlite_close().
+    if (max_ms > 0 && serialized(conn) && !batch.timer.joinable()) batch.timer = std::thread(batch_timer_run, conn);
+    // Changing or disabling the limits flushes whatever is pending under the old ones.
+    return phasor_make_bool(commit_batch(conn) == SQLITE_OK);
+}
+
+PhasorValue sqlite_write_queue(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc < 2 || argc > 3 || !phasor_is_int(argv[0]) || !phasor_is_bool(argv[1])) return phasor_make_bool(false);
+    if (argc == 3 && !phasor_is_bool(argv[2])) return phasor_make_bool(false);
+    Connection* conn = get_connection((int)phasor_to_int(argv[0]));
+    if (!conn) return phasor_make_bool(false);
+
+    if (!phasor_to_bool(argv[1])) {
+        stop_write_queue(conn);
+        return phasor_make_bool(true);
+    }
+
+    // The writer thread uses the connection while the script keeps running, which SQLite only
+    // guards against on serialized connections.
+    if (!serialized(conn)) return phasor_make_bool(false);
+
+    WriteQueue& queue = conn->queue;
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (argc == 3) queue.wait_commit = phasor_to_bool(argv[2]);
+        if (queue.running) return phasor_make_bool(true);
+    }
+
+    // The writer thread opens its own transactions, so the batcher steps aside and the
+    // script may not be inside one.
+    {
+        std::lock_guard<std::mutex> lock(conn->batch.mutex);
+        if (commit_batch(conn) != SQLITE_OK) return phasor_make_bool(false);
+        conn->batch.enabled = false;
+    }
+    if (!sqlite3_get_autocommit(conn->db)) return phasor_make_bool(false);
+
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.running) {
+        queue.running = true;
+        queue.thread = std::thread(write_queue_run, conn);
+    }
+    return phasor_make_bool(true);
+}
+
+PhasorValue sqlite_write_queue_stats(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 1 || !phasor_is_int(argv[0])) return phasor_make_null();
+    Connection* conn = get_connection((int)phasor_to_int(argv[0]));
+    if (!conn) return phasor_make_null();
+
+    static thread_local PhasorValue stats[4];
+    std::lock_guard<std::mutex> lock(conn->queue.mutex);
+    const WriteQueue& queue = conn->queue;
+    stats[0] = phasor_make_int((int64_t)queue.groups);
+    stats[1] = phasor_make_int((int64_t)queue.jobs);
+    stats[2] = phasor_make_int((int64_t)queue.failures);
+    stats[3] = phasor_make_int((int64_t)queue.pending.size());
+    return phasor_make_array(stats, 4);
+}
+
+PhasorValue sqlite_checkpointer_start(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc < 1 || argc > 4) return phasor_make_bool(false);
+    for (int i = 0; i < argc; i++)
+        if (!phasor_is_int(argv[i]) || (i > 0 && (phasor_to_int(argv[i]) < 1 || phasor_to_int(argv[i]) > INT32_MAX)))
+            return phasor_make_bool(false);
+    Connection* conn = get_connection((int)phasor_to_int(argv[0]));
+    if (!conn) return phasor_make_bool(false);
+
+    int passive_pages = argc > 1 ? (int)phasor_to_int(argv[1]) : 1000;
+    int restart_pages = argc > 2 ? (int)phasor_to_int(argv[2]) : std::max(passive_pages, 4000);
+    int truncate_pages = argc > 3 ? (int)phasor_to_int(argv[3]) : std::max(restart_pages, 16000);
+    if (restart_pages < passive_pages || truncate_pages < restart_pages) return phasor_make_bool(false);
+
+    Checkpointer& checkpointer = conn->checkpointer;
     {
-        std::lock_guard<std::mutex> lock(db_mutex);
-        auto it = db_table.find(handle);
-        if (it != db_table.end()) { db = it->second; db_table.erase(it); }
+        std::lock_guard<std::mutex> lock(checkpointer.mutex);
+        checkpointer.passive_pages = passive_pages;
+        checkpointer.restart_pages = restart_pages;
+        checkpointer.truncate_pages = truncate_pages;
+        if (checkpointer.running) return phasor_make_bool(true);
     }
 
-    if (db) {
+    // Checkpoints need a database file in WAL mode, seen through a second connection.
+    const char* path = sqlite3_db_filename(conn->db, "main");
+    if (!path || !*path) return phasor_make_bool(false);
+    sqlite3* db = nullptr;
+    bool wal = false;
+    if (sqlite3_open_v2(path, &db, SQLITE_OPEN_READWRITE, nullptr) == SQLITE_OK) {
+        sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v2(db, "PRAGMA journal_mode", -1, &stmt, nullptr) == SQLITE_OK &&
+            sqlite3_step(stmt) == SQLITE_ROW) {
+            const char* mode = (const char*)sqlite3_column_text(stmt, 0);
+            wal = mode && strcmp(mode, "wal") == 0;
+        }
+        sqlite3_finalize(stmt);
+    }
+    if (!wal) {
         sqlite3_close(db);
-        return phasor_make_bool(true);
+        return phasor_make_bool(false);
     }
-    return phasor_make_bool(false);
+
+    sqlite3_stmt* stmt = nullptr;
+    int autocheckpoint = 1000;
+    if (sqlite3_prepare_v2(conn->db, "PRAGMA wal_autocheckpoint", -1, &stmt, nullptr) == SQLITE_OK &&
+        sqlite3_step(stmt) == SQLITE_ROW)
+        autocheckpoint = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+
+    {
+        std::lock_guard<std::mutex> lock(checkpointer.mutex);
+        sqlite3_busy_timeout(db, 10);
+        checkpointer.db = db;
+        checkpointer.autocheckpoint = autocheckpoint;
+        checkpointer.running = true;
+        checkpointer.thread = std::thread(checkpointer_run, &checkpointer);
+    }
+    // Taking over the WAL hook also turns off the inline auto-checkpoint.
+    sqlite3_wal_hook(conn->db, checkpointer_hook, &checkpointer);
+    return phasor_make_bool(true);
 }
 
-PhasorValue sqlite_exec(PhasorVM* vm, int argc, const PhasorValue* argv) {
-    if (argc != 2 || !phasor_is_int(argv[0]) || !phasor_is_string(argv[1])) 
+PhasorValue sqlite_checkpointer_stop(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 1 || !phasor_is_int(argv[0])) return phasor_make_bool(false);
+    Connection* conn = get_connection((int)phasor_to_int(argv[0]));
+    if (!conn) return phasor_make_bool(false);
+
+    stop_checkpointer(conn);
+    return phasor_make_bool(true);
+}
+
+PhasorValue sqlite_checkpointer_stats(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 1 || !phasor_is_int(argv[0])) return phasor_make_null();
+    Connection* conn = get_connection((int)phasor_to_int(argv[0]));
+    if (!conn) return phasor_make_null();
+
+    static thread_local PhasorValue stats[4];
+    std::lock_guard<std::mutex> lock(conn->checkpointer.mutex);
+    const Checkpointer& checkpointer = conn->checkpointer;
+    stats[0] = phasor_make_int((int64_t)checkpointer.passive);
+    stats[1] = phasor_make_int((int64_t)checkpointer.restarts);
+    stats[2] = phasor_make_int((int64_t)checkpointer.truncates);
+    stats[3] = phasor_make_int((int64_t)checkpointer.busy);
+    return phasor_make_array(stats, 4);
+}
+
+// Virtual machine instructions between deadline checks; a clock read every few microseconds
+// of query execution is not measurable.
+static const int deadline_check_interval = 1000;
+
+PhasorValue sqlite_set_timeout(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 2 || !phasor_is_int(argv[0]) || !phasor_is_int(argv[1]) || phasor_to_int(argv[1]) < 0)
         return phasor_make_bool(false);
+    Connection* conn = get_connection((int)phasor_to_int(argv[0]));
+    if (!conn) return phasor_make_bool(false);
 
-    int handle = (int)phasor_to_int(argv[0]);
-    const char* sql = phasor_to_string(argv[1]);
-    sqlite3* db = get_db(handle);
-    if (!db) return phasor_make_bool(false);
+    int64_t ms = phasor_to_int(argv[1]);
+    conn->timeout_ms = ms;
+    // Without a timeout the handler is removed, so untimed connections pay nothing.
+    auto install = [ms](sqlite3* db) {
+        if (ms > 0) sqlite3_progress_handler(db, deadline_check_interval, check_deadline, db);
+        else sqlite3_progress_handler(db, 0, nullptr, nullptr);
+    };
+    install(conn->db);
+    for (Connection* reader : conn->readers) install(reader->db);
+    return phasor_make_bool(true);
+}
+
+PhasorValue sqlite_interrupt(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 1 || !phasor_is_int(argv[0])) return phasor_make_bool(false);
+    Connection* conn = get_connection((int)phasor_to_int(argv[0]));
+    if (!conn) return phasor_make_bool(false);
+
+    sqlite3_interrupt(conn->db);
+    for (Connection* reader : conn->readers) sqlite3_interrupt(reader->db);
+    return phasor_make_bool(true);
+}
 
-    char* err = nullptr;
-    if (sqlite3_exec(db, sql, nullptr, nullptr, &err) != SQLITE_OK) {
-        if (err) sqlite3_free(err);
+PhasorValue sqlite_busy_timeout(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 2 || !phasor_is_int(argv[0]) || !phasor_is_int(argv[1]) || phasor_to_int(argv[1]) < 0 ||
+        phasor_to_int(argv[1]) > 2147483647)
         return phasor_make_bool(false);
-    }
+    Connection* conn = get_connection((int)phasor_to_int(argv[0]));
+    if (!conn) return phasor_make_bool(false);
+
+    // Replaces a backoff handler as well; 0 turns waiting off.
+    int ms = (int)phasor_to_int(argv[1]);
+    conn->busy.total_ms = 0;
+    sqlite3_busy_timeout(conn->db, ms);
+    for (Connection* reader : conn->readers) sqlite3_busy_timeout(reader->db, ms);
     return phasor_make_bool(true);
 }
 
-PhasorValue sqlite_prepare(PhasorVM* vm, int argc, const PhasorValue* argv) {
-    if (argc != 2 || !phasor_is_int(argv[0]) || !phasor_is_string(argv[1])) return phasor_make_null();
-    int db_handle = (int)phasor_to_int(argv[0]);
-    const char* sql = phasor_to_string(argv[1]);
-    sqlite3* db = get_db(db_handle);
-    if (!db) return phasor_make_null();
+PhasorValue sqlite_busy_backoff(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc < 2 || argc > 4) return phasor_make_bool(false);
+    for (int i = 0; i < argc; i++)
+        if (!phasor_is_int(argv[i]) || (i > 0 && phasor_to_int(argv[i]) < 0)) return phasor_make_bool(false);
+    Connection* conn = get_connection((int)phasor_to_int(argv[0]));
+    if (!conn) return phasor_make_bool(false);
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) return phasor_make_null();
+    int64_t total_ms = phasor_to_int(argv[1]);
+    int64_t initial_ms = argc > 2 ? phasor_to_int(argv[2]) : 1;
+    int64_t max_ms = argc > 3 ? phasor_to_int(argv[3]) : 100;
+    if (initial_ms < 1 || max_ms < initial_ms) return phasor_make_bool(false);
+
+    conn->busy.initial_ms = initial_ms;
+    conn->busy.max_ms = max_ms;
+    conn->busy.total_ms = total_ms;
+    // The readers of a pool point at the writer's policy, so one call covers all of them.
+    auto install = [conn, total_ms](sqlite3* db) {
+        if (total_ms > 0) sqlite3_busy_handler(db, busy_backoff, &conn->busy);
+        else sqlite3_busy_handler(db, nullptr, nullptr);
+    };
+    install(conn->db);
+    for (Connection* reader : conn->readers) install(reader->db);
+    return phasor_make_bool(true);
+}
+
+PhasorValue sqlite_busy_retry(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 2 || !phasor_is_int(argv[0]) || !phasor_is_int(argv[1]) || phasor_to_int(argv[1]) < 0 ||
+        phasor_to_int(argv[1]) > 1000)
+        return phasor_make_bool(false);
+    Connection* conn = get_connection((int)phasor_to_int(argv[0]));
+    if (!conn) return phasor_make_bool(false);
+
+    conn->busy.retries = (int)phasor_to_int(argv[1]);
+    return phasor_make_bool(true);
+}
+
+PhasorValue sqlite_busy_stats(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 1 || !phasor_is_int(argv[0])) return phasor_make_null();
+    Connection* conn = get_connection((int)phasor_to_int(argv[0]));
+    if (!conn) return phasor_make_null();
+
+    static thread_local PhasorValue stats[3];
+    stats[0] = phasor_make_int((int64_t)conn->busy.waits.load(std::memory_order_relaxed));
+    stats[1] = phasor_make_int((int64_t)conn->busy.retried.load(std::memory_order_relaxed));
+    stats[2] = phasor_make_int((int64_t)conn->busy.failures.load(std::memory_order_relaxed));
+    return phasor_make_array(stats, 3);
+}
+
+PhasorValue sqlite_cache_capacity(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 2 || !phasor_is_int(argv[0]) || !phasor_is_int(argv[1]) || phasor_to_int(argv[1]) < 0)
+        return phasor_make_bool(false);
+    Connection* conn = get_connection((int)phasor_to_int(argv[0]));
+    if (!conn) return phasor_make_bool(false);
+
+    resize_cache(conn, (size_t)phasor_to_int(argv[1]));
+    return phasor_make_bool(true);
+}
+
+PhasorValue sqlite_cache_stats(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 1 || !phasor_is_int(argv[0])) return phasor_make_null();
+    Connection* conn = get_connection((int)phasor_to_int(argv[0]));
+    if (!conn) return phasor_make_null();
+
+    static thread_local PhasorValue stats[5];
+    std::lock_guard<std::mutex> lock(conn->cache_mutex);
+    const StatementCache& cache = conn->cache;
+    stats[0] = phasor_make_int((int64_t)cache.hits);
+    stats[1] = phasor_make_int((int64_t)cache.misses);
+    stats[2] = phasor_make_int((int64_t)cache.evictions);
+    stats[3] = phasor_make_int((int64_t)cache.entries.size());
+    stats[4] = phasor_make_int((int64_t)cache.capacity);
+    return phasor_make_array(stats, 5);
+}
+
+
+// Fixed set of worker threads that run the *_async functions. Started on first use and never
+// stopped: idle workers only wait on a condition variable, and joining them from a static
+// destructor could deadlock if the host unloads the plugin while a query is still running.
+class WorkerPool {
+public:
+    void submit(std::function<void()> job) {
+        std::call_once(started, [this] {
+            unsigned count = std::thread::hardware_concurrency();
+            count = count < 2 ? 2 : count > 8 ? 8 : count;
+            for (unsigned i = 0; i < count; i++) std::thread([this] { run(); }).detach();
+        });
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(std::move(job));
+        }
+        available.notify_one();
+    }
+
+private:
+    void run() {
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                available.wait(lock, [this] { return !jobs.empty(); });
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
 
-    std::lock_guard<std::mutex> lock(stmt_mutex);
-    int handle = next_stmt_handle++;
-    stmt_table[handle] = stmt;
+    std::once_flag started;
+    std::mutex mutex;
+    std::condition_variable available;
+    std::deque<std::function<void()>> jobs;
+};
+
+static WorkerPool* worker_pool = new WorkerPool(); // intentionally leaked, see above
+
+// Queues `function` with copies of its arguments and returns a future handle for its result.
+// String arguments are copied because the VM's strings may not outlive this call.
+PhasorValue run_async(PhasorNativeFunction function, int argc, const PhasorValue* argv) {
+    Future* future = new Future();
+    int handle = future_table.insert(future);
+    if (!handle) {
+        delete future;
+        return phasor_make_null();
+    }
+
+    std::vector<std::string> strings;
+    std::vector<PhasorValue> args(argv, argv + argc);
+    for (const PhasorValue& arg : args) {
+        if (phasor_is_string(arg)) strings.push_back(phasor_to_string(arg));
+    }
+
+    worker_pool->submit([future, function, args, strings]() mutable {
+        size_t next_string = 0;
+        for (PhasorValue& arg : args) {
+            if (phasor_is_string(arg)) arg.as.s = strings[next_string++].c_str();
+        }
+        PhasorValue result = function(nullptr, (int)args.size(), args.data());
+        // Notify under the lock: the awaiting thread deletes the future as soon as it sees `done`.
+        std::lock_guard<std::mutex> lock(future->mutex);
+        future->result = result;
+        future->done = true;
+        future->finished.notify_all();
+    });
     return phasor_make_int(handle);
 }
 
-PhasorValue sqlite_step(PhasorVM* vm, int argc, const PhasorValue* argv) {
+// The async functions hand a connection to a worker thread while the script keeps running, so
+// they refuse connections opened with nomutex, which SQLite does not guard against that.
+PhasorValue sqlite_exec_async(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 2 || !phasor_is_int(argv[0]) || !phasor_is_string(argv[1])) return phasor_make_null();
+    Connection* conn = get_connection((int)phasor_to_int(argv[0]));
+    if (!conn || !serialized(conn)) return phasor_make_null();
+    return run_async(&sqlite_exec, argc, argv);
+}
+
+PhasorValue sqlite_prepare_async(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 2 || !phasor_is_int(argv[0]) || !phasor_is_string(argv[1])) return phasor_make_null();
+    Connection* conn = get_connection((int)phasor_to_int(argv[0]));
+    if (!conn || !serialized(conn)) return phasor_make_null();
+    return run_async(&sqlite_prepare, argc, argv);
+}
+
+PhasorValue sqlite_step_async(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 1 || !phasor_is_int(argv[0])) return phasor_make_null();
+    Statement* statement = get_statement((int)phasor_to_int(argv[0]));
+    if (!statement || !sqlite3_db_mutex(sqlite3_db_handle(statement->stmt))) return phasor_make_null();
+    return run_async(&sqlite_step, argc, argv);
+}
+
+PhasorValue sqlite_poll(PhasorVM* vm, int argc, const PhasorValue* argv) {
     if (argc != 1 || !phasor_is_int(argv[0])) return phasor_make_null();
+    Future* future = future_table.get((int)phasor_to_int(argv[0]));
+    if (!future) return phasor_make_null();
+
+    std::lock_guard<std::mutex> lock(future->mutex);
+    return phasor_make_bool(future->done);
+}
+
+PhasorValue sqlite_await(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc < 1 || argc > 2 || !phasor_is_int(argv[0])) return phasor_make_null();
+    if (argc == 2 && !phasor_is_int(argv[1])) return phasor_make_null();
     int handle = (int)phasor_to_int(argv[0]);
-    sqlite3_stmt* stmt = get_stmt(handle);
-    if (!stmt) return phasor_make_null();
+    Future* future = future_table.get(handle);
+    if (!future) return phasor_make_null();
 
-    int rc = sqlite3_step(stmt);
-    if (rc == SQLITE_ROW) return phasor_make_bool(true);
-    if (rc == SQLITE_DONE) return phasor_make_bool(false);
-    return phasor_make_null();
+    {
+        std::unique_lock<std::mutex> lock(future->mutex);
+        auto is_done = [future] { return future->done; };
+        if (argc == 2 && phasor_to_int(argv[1]) >= 0) {
+            // On timeout the future stays valid and can be awaited again.
+            if (!future->finished.wait_for(lock, std::chrono::milliseconds(phasor_to_int(argv[1])), is_done))
+                return phasor_make_null();
+        } else {
+            future->finished.wait(lock, is_done);
+        }
+    }
+
+    if (future_table.remove(handle) != future) return phasor_make_null();
+    PhasorValue result = future->result;
+    delete future;
+    return result;
 }
 
-PhasorValue sqlite_column(PhasorVM* vm, int argc, const PhasorValue* argv) {
-    if (argc != 2 || !phasor_is_int(argv[0]) || !phasor_is_int(argv[1])) return phasor_make_null();
-    int stmt_handle = (int)phasor_to_int(argv[0]);
-    int col_index = (int)phasor_to_int(argv[1]);
-    sqlite3_stmt* stmt = get_stmt(stmt_handle);
-    if (!stmt) return phasor_make_null();
+PhasorValue sqlite_backup_start(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 2 || !phasor_is_int(argv[0]) || !phasor_is_string(argv[1])) return phasor_make_null();
+    sqlite3* src = get_db((int)phasor_to_int(argv[0]));
+    if (!src) return phasor_make_null();
 
-    int count = sqlite3_column_count(stmt);
-    if (col_index < 0 || col_index >= count) return phasor_make_null();
+    sqlite3* dest = open_connection(phasor_to_string(argv[1]), OpenOptions());
+    if (!dest) return phasor_make_null();
+    sqlite3_backup* handle = sqlite3_backup_init(dest, "main", src, "main");
+    if (!handle) {
+        sqlite3_close(dest);
+        return phasor_make_null();
+    }
 
-    int type = sqlite3_column_type(stmt, col_index);
-    switch (type) {
-    case SQLITE_INTEGER: return phasor_make_int(sqlite3_column_int(stmt, col_index));
-    case SQLITE_FLOAT:   return phasor_make_float(sqlite3_column_double(stmt, col_index));
-    case SQLITE_TEXT: {
-        const unsigned char* text = sqlite3_column_text(stmt, col_index);
-        if (!text) return phasor_make_null();
-    
-        int str_handle = store_string((const char*)text);
-        return phasor_make_string(get_string(str_handle));
+    Backup* backup = new Backup();
+    backup->dest = dest;
+    backup->backup = handle;
+    backup->remaining = -1; // unknown until the first step
+    backup->pagecount = -1;
+    backup->source_serialized = sqlite3_db_mutex(src) != nullptr;
+    int id = backup_table.insert(backup);
+    if (!id) {
+        sqlite3_backup_finish(handle);
+        sqlite3_close(dest);
+        delete backup;
+        return phasor_make_null();
     }
+    return phasor_make_int(id);
+}
 
-    case SQLITE_NULL: return phasor_make_null();
-    default: return phasor_make_null();
+// Copies up to `pages` pages (all of them if negative). Called with backup->mutex held.
+// BUSY and LOCKED only mean the source was in use; the next step tries again.
+int backup_pages(Backup* backup, int pages) {
+    if (backup->rc == SQLITE_DONE) return SQLITE_DONE;
+    int rc = sqlite3_backup_step(backup->backup, pages);
+    if (rc == SQLITE_BUSY || rc == SQLITE_LOCKED) rc = SQLITE_OK;
+    backup->rc = rc;
+    backup->remaining = sqlite3_backup_remaining(backup->backup);
+    backup->pagecount = sqlite3_backup_pagecount(backup->backup);
+    return rc;
+}
+
+PhasorValue sqlite_backup_step(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 2 || !phasor_is_int(argv[0]) || !phasor_is_int(argv[1])) return phasor_make_bool(false);
+    Backup* backup = backup_table.get((int)phasor_to_int(argv[0]));
+    if (!backup) return phasor_make_bool(false);
+
+    std::lock_guard<std::mutex> lock(backup->mutex);
+    int rc = backup_pages(backup, (int)std::max<int64_t>(std::min<int64_t>(phasor_to_int(argv[1]), INT32_MAX), -1));
+    if (rc != SQLITE_OK && rc != SQLITE_DONE) return phasor_make_bool(false);
+    return phasor_make_int(rc == SQLITE_DONE ? 0 : backup->remaining.load());
+}
+
+PhasorValue sqlite_backup_progress(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 1 || !phasor_is_int(argv[0])) return phasor_make_null();
+    Backup* backup = backup_table.get((int)phasor_to_int(argv[0]));
+    if (!backup) return phasor_make_null();
+
+    static thread_local PhasorValue progress[2];
+    progress[0] = phasor_make_int(backup->remaining.load());
+    progress[1] = phasor_make_int(backup->pagecount.load());
+    return phasor_make_array(progress, 2);
+}
+
+// Pacing thread: copies `pages` pages, then sleeps `ms` milliseconds, until the copy is done,
+// fails, or sqlite_backup_finish stops it. The source is only locked while a step runs, so
+// writers and checkpoints proceed between steps.
+void backup_run(Backup* backup, int pages, int64_t ms) {
+    std::unique_lock<std::mutex> lock(backup->mutex);
+    while (!backup->stop) {
+        int rc = backup_pages(backup, pages);
+        if (rc != SQLITE_OK) break;
+        backup->wake.wait_for(lock, std::chrono::milliseconds(ms), [backup] { return backup->stop; });
     }
 }
 
-PhasorValue sqlite_finalize(PhasorVM* vm, int argc, const PhasorValue* argv) {
-    if (argc != 1 || !phasor_is_int(argv[0])) return phasor_make_bool(false);
+PhasorValue sqlite_backup_background(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 3 || !phasor_is_int(argv[0]) || !phasor_is_int(argv[1]) || !phasor_is_int(argv[2]))
+        return phasor_make_bool(false);
+    int64_t pages = phasor_to_int(argv[1]);
+    int64_t ms = phasor_to_int(argv[2]);
+    if (pages <= 0 || pages > INT32_MAX || ms < 0) return phasor_make_bool(false);
+    Backup* backup = backup_table.get((int)phasor_to_int(argv[0]));
+    // The pacing thread reads the source while the script keeps using it, which SQLite only
+    // guards against when the source connection is serialized.
+    if (!backup || !backup->source_serialized) return phasor_make_bool(false);
 
-    int handle = (int)phasor_to_int(argv[0]);
-    sqlite3_stmt* stmt = nullptr;
+    std::lock_guard<std::mutex> lock(backup->mutex);
+    if (backup->thread.joinable()) return phasor_make_bool(false);
+    backup->thread = std::thread(backup_run, backup, (int)pages, ms);
+    return phasor_make_bool(true);
+}
+
+PhasorValue sqlite_backup_finish(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc < 1 || argc > 2 || !phasor_is_int(argv[0])) return phasor_make_bool(false);
+    if (argc == 2 && !phasor_is_bool(argv[1])) return phasor_make_bool(false);
+    Backup* backup = backup_table.remove((int)phasor_to_int(argv[0]));
+    if (!backup) return phasor_make_bool(false);
+
+    bool wait = argc == 2 && phasor_to_bool(argv[1]);
+    if (backup->thread.joinable()) {
+        if (!wait) {
+            std::lock_guard<std::mutex> lock(backup->mutex);
+            backup->stop = true;
+        }
+        backup->wake.notify_one();
+        backup->thread.join();
+    } else if (wait) {
+        std::lock_guard<std::mutex> lock(backup->mutex);
+        backup_pages(backup, -1);
+    }
+
+    // An unfinished backup is abandoned; the destination keeps whatever pages were copied.
+    bool complete = backup->rc == SQLITE_DONE;
+    int rc = sqlite3_backup_finish(backup->backup);
+    sqlite3_close(backup->dest);
+    delete backup;
+    return phasor_make_bool(complete && rc == SQLITE_OK);
+}
+
+// Size-class pool allocator installed through SQLITE_CONFIG_MALLOC when PHASOR_SQLITE_ALLOCATOR=pool.
+// Small blocks are carved from chunks that are never returned to the system, handed out from a
+// per-thread free list, and exchanged with a shared per-class list in batches, so the common
+// malloc/free pair takes no lock. Anything larger than the biggest class goes to malloc.
+namespace pool {
+
+const size_t class_sizes[] = {16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096};
+const int class_count = sizeof(class_sizes) / sizeof(class_sizes[0]);
+const int large = class_count; // counter slot for blocks from malloc
+const size_t header = 8;       // class index, or the size of a large block, before every block
+const size_t chunk_bytes = 64 * 1024;
+
+struct Block {
+    Block* next;
+};
+
+struct SharedClass {
+    std::mutex mutex;
+    Block* free = nullptr;
+    char* chunk = nullptr; // uncarved rest of the newest chunk
+    size_t chunk_left = 0;
+    uint64_t refills = 0;
+};
+
+// Counters are only written by their thread, so plain relaxed stores are enough.
+struct Counters {
+    std::atomic<uint64_t> allocations[class_count + 1];
+    std::atomic<uint64_t> frees[class_count + 1];
+    Counters() {
+        for (int i = 0; i <= class_count; i++) allocations[i] = frees[i] = 0;
+    }
+};
+
+struct ThreadCache;
+
+// Shared state is never destroyed: SQLite may still free blocks after static destructors ran.
+struct State {
+    SharedClass classes[class_count];
+    std::mutex threads_mutex;
+    std::vector<ThreadCache*> threads;
+    Counters retired; // totals of threads that have exited
+};
+State& state() {
+    static State* shared = new State();
+    return *shared;
+}
+
+size_t cache_limit(int c) {
+    return std::max<size_t>(8, 32 * 1024 / class_sizes[c]);
+}
+
+void bump(std::atomic<uint64_t>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+// Moves up to `count` blocks from the shared list of class `c`, carving new ones if it runs dry.
+Block* take_shared(int c, size_t count, size_t* taken) {
+    SharedClass& shared = state().classes[c];
+    size_t stride = header + class_sizes[c];
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    shared.refills++;
+    Block* list = nullptr;
+    size_t n = 0;
+    for (; n < count; n++) {
+        Block* block = shared.free;
+        if (block) {
+            shared.free = block->next;
+        } else {
+            if (shared.chunk_left < stride) {
+                char* chunk = (char*)malloc(chunk_bytes);
+                if (!chunk) break;
+                shared.chunk = chunk;
+                shared.chunk_left = chunk_bytes;
+            }
+            *(uint64_t*)shared.chunk = (uint64_t)c;
+            block = (Block*)(shared.chunk + header);
+            shared.chunk += stride;
+            shared.chunk_left -= stride;
+        }
+        block->next = list;
+        list = block;
+    }
+    *taken = n;
+    return list;
+}
+
+void give_shared(int c, Block* list) {
+    if (!list) return;
+    Block* last = list;
+    while (last->next) last = last->next;
+    SharedClass& shared = state().classes[c];
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    last->next = shared.free;
+    shared.free = list;
+}
+
+struct ThreadCache {
+    Block* free[class_count] = {};
+    size_t count[class_count] = {};
+    Counters counters;
+};
+
+// Returns a thread's cache to the shared state when the thread exits.
+struct CacheOwner {
+    ThreadCache* cache = nullptr;
+    ~CacheOwner();
+};
+
+thread_local CacheOwner owner;
+thread_local bool exited = false; // trivially destructible, so still readable after `owner` is gone
+
+CacheOwner::~CacheOwner() {
+    exited = true;
+    if (!cache) return;
+    for (int c = 0; c < class_count; c++) give_shared(c, cache->free[c]);
+    State& shared = state();
     {
-        std::lock_guard<std::mutex> lock(stmt_mutex);
-        auto it = stmt_table.find(handle);
-        if (it != stmt_table.end()) { stmt = it->second; stmt_table.erase(it); }
+        std::lock_guard<std::mutex> lock(shared.threads_mutex);
+        for (int i = 0; i <= class_count; i++) {
+            shared.retired.allocations[i] += cache->counters.allocations[i].load(std::memory_order_relaxed);
+            shared.retired.frees[i] += cache->counters.frees[i].load(std::memory_order_relaxed);
+        }
+        shared.threads.erase(std::find(shared.threads.begin(), shared.threads.end(), cache));
     }
+    delete cache;
+}
 
-    if (stmt) {
-        sqlite3_finalize(stmt);
-        return phasor_make_bool(true);
+// The calling thread's cache, or null once the thread is exiting; memory SQLite allocates or
+// frees from other thread-local destructors then goes straight to the shared lists.
+ThreadCache* cache() {
+    if (exited) return nullptr;
+    if (!owner.cache) {
+        ThreadCache* local = new ThreadCache();
+        std::lock_guard<std::mutex> lock(state().threads_mutex);
+        state().threads.push_back(local);
+        owner.cache = local;
     }
-    return phasor_make_bool(false);
+    return owner.cache;
+}
+
+std::atomic<uint64_t>& counter(ThreadCache* local, bool allocation, int c) {
+    Counters& counters = local ? local->counters : state().retired;
+    return allocation ? counters.allocations[c] : counters.frees[c];
+}
+
+void count(ThreadCache* local, bool allocation, int c) {
+    if (local) bump(counter(local, allocation, c));
+    else counter(local, allocation, c).fetch_add(1, std::memory_order_relaxed);
 }
 
+int size_class(size_t size) {
+    for (int c = 0; c < class_count; c++)
+        if (size <= class_sizes[c]) return c;
+    return large;
+}
+
+void* allocate(int n) {
+    if (n <= 0) return nullptr;
+    ThreadCache* local = cache();
+    int c = size_class((size_t)n);
+    if (c == large) {
+        char* raw = (char*)malloc(header + (size_t)n);
+        if (!raw) return nullptr;
+        count(local, true, c);
+        *(uint64_t*)raw = (uint64_t)n;
+        return raw + header;
+    }
+    size_t taken;
+    if (!local) {
+        Block* block = take_shared(c, 1, &taken);
+        if (block) count(local, true, c);
+        return block;
+    }
+    if (!local->free[c]) local->free[c] = take_shared(c, cache_limit(c) / 2, &local->count[c]);
+    Block* block = local->free[c];
+    if (!block) return nullptr;
+    local->free[c] = block->next;
+    local->count[c]--;
+    count(local, true, c);
+    return block;
+}
+
+uint64_t tag(void* p) {
+    return *(uint64_t*)((char*)p - header);
+}
+
+void release(void* p) {
+    if (!p) return;
+    ThreadCache* local = cache();
+    uint64_t c = tag(p);
+    if (c >= (uint64_t)class_count) {
+        count(local, false, large);
+        free((char*)p - header);
+        return;
+    }
+    count(local, false, (int)c);
+    Block* block = (Block*)p;
+    if (!local) {
+        block->next = nullptr;
+        give_shared((int)c, block);
+        return;
+    }
+    block->next = local->free[c];
+    local->free[c] = block;
+    // A thread that frees what others allocated hands half of its list back once it is full.
+    if (++local->count[c] > cache_limit(c)) {
+        size_t keep = cache_limit(c) / 2;
+        Block* last = local->free[c];
+        for (size_t i = 1; i < keep; i++) last = last->next;
+        give_shared((int)c, last->next);
+        last->next = nullptr;
+        local->count[c] = keep;
+    }
+}
+
+int usable_size(void* p) {
+    uint64_t c = tag(p);
+    return (int)(c < (uint64_t)class_count ? class_sizes[c] : c);
+}
+
+void* reallocate(void* p, int n) {
+    if (n <= 0) return nullptr;
+    int old = usable_size(p);
+    if (n <= old && size_class((size_t)n) == size_class((size_t)old)) return p;
+    void* fresh = allocate(n);
+    if (!fresh) return nullptr;
+    memcpy(fresh, p, (size_t)std::min(old, n));
+    release(p);
+    return fresh;
+}
 
+int roundup(int n) {
+    int c = size_class((size_t)n);
+    return c == large ? (n + 7) & ~7 : (int)class_sizes[c];
+}
+
+int init(void*) {
+    return SQLITE_OK;
+}
+
+void shutdown(void*) {}
+
+bool installed = false;
+
+void install() {
+    static const sqlite3_mem_methods methods = {
+        [](int n) { return allocate(n); }, [](void* p) { release(p); },
+        [](void* p, int n) { return reallocate(p, n); }, [](void* p) { return usable_size(p); },
+        roundup, init, shutdown, nullptr,
+    };
+    // SQLite's own statistics would put a global mutex back on every allocation.
+    installed = sqlite3_config(SQLITE_CONFIG_MALLOC, &methods) == SQLITE_OK;
+    if (installed) sqlite3_config(SQLITE_CONFIG_MEMSTATUS, 0);
+}
+
+} // namespace pool
+
+PhasorValue sqlite_allocator_stats(PhasorVM* vm, int argc, const PhasorValue* argv) {
+    if (argc != 0 || !pool::installed) return phasor_make_null();
+
+    static thread_local PhasorValue rows[pool::class_count + 1];
+    static thread_local PhasorValue cells[pool::class_count + 1][4];
+    pool::State& state = pool::state();
+    std::lock_guard<std::mutex> lock(state.threads_mutex);
+    for (int c = 0; c <= pool::class_count; c++) {
+        uint64_t allocations = state.retired.allocations[c].load(std::memory_order_relaxed);
+        uint64_t frees = state.retired.frees[c].load(std::memory_order_relaxed);
+        for (pool::ThreadCache* thread : state.threads) {
+            allocations += thread->counters.allocations[c].load(std::memory_order_relaxed);
+            frees += thread->counters.frees[c].load(std::memory_order_relaxed);
+        }
+        uint64_t refills = 0;
+        if (c < pool::class_count) {
+            std::lock_guard<std::mutex> class_lock(state.classes[c].mutex);
+            refills = state.classes[c].refills;
+        }
+        cells[c][0] = phasor_make_int(c < pool::class_count ? (int64_t)pool::class_sizes[c] : 0);
+        cells[c][1] = phasor_make_int((int64_t)(allocations - frees));
+        cells[c][2] = phasor_make_int((int64_t)allocations);
+        cells[c][3] = phasor_make_int((int64_t)refills);
+        rows[c] = phasor_make_array(cells[c], 4);
+    }
+    return phasor_make_array(rows, pool::class_count + 1);
+}
+
+// Strings are no longer copied into a plugin-side table, so there is nothing to free.
+// Kept so that existing scripts calling it continue to load.
 PhasorValue sqlite_free_string(PhasorVM* vm, int argc, const PhasorValue* argv) {
-    if (argc != 1 || !phasor_is_int(argv[0])) return phasor_make_null();
-    int handle = (int)phasor_to_int(argv[0]);
-    free_string(handle);
     return phasor_make_null();
 }
 
 PHASOR_FFI_EXPORT void phasor_plugin_entry(const PhasorAPI* api, PhasorVM* vm) {
+    // Allocator settings only take effect before SQLite initializes, so the first load decides.
+    static std::once_flag configured;
+    std::call_once(configured, [] {
+        const char* allocator = getenv("PHASOR_SQLITE_ALLOCATOR");
+        if (allocator && strcmp(allocator, "pool") == 0) pool::install();
+    });
+
+    api->register_function(vm, "sqlite_configure", &sqlite_configure);
     api->register_function(vm, "sqlite_open", &sqlite_open);
+    api->register_function(vm, "sqlite_open_ex", &sqlite_open_ex);
+    api->register_function(vm, "sqlite_pool_open", &sqlite_pool_open);
+    api->register_function(vm, "sqlite_load_into_memory", &sqlite_load_into_memory);
+    api->register_function(vm, "sqlite_snapshot_to_file", &sqlite_snapshot_to_file);
+    api->register_function(vm, "sqlite_clone", &sqlite_clone);
     api->register_function(vm, "sqlite_close", &sqlite_close);
     api->register_function(vm, "sqlite_exec", &sqlite_exec);
     api->register_function(vm, "sqlite_prepare", &sqlite_prepare);
     api->register_function(vm, "sqlite_step", &sqlite_step);
     api->register_function(vm, "sqlite_column", &sqlite_column);
+    api->register_function(vm, "sqlite_column_blob", &sqlite_column_blob);
+    api->register_function(vm, "sqlite_bind", &sqlite_bind);
+    api->register_function(vm, "sqlite_bind_int", &sqlite_bind_int);
+    api->register_function(vm, "sqlite_bind_float", &sqlite_bind_float);
+    api->register_function(vm, "sqlite_bind_text", &sqlite_bind_text);
+    api->register_function(vm, "sqlite_bind_null", &sqlite_bind_null);
+    api->register_function(vm, "sqlite_bind_named", &sqlite_bind_named);
+    api->register_function(vm, "sqlite_bind_blob", &sqlite_bind_blob);
+    api->register_function(vm, "sqlite_bind_zeroblob", &sqlite_bind_zeroblob);
+    api->register_function(vm, "sqlite_buffer_new", &sqlite_buffer_new);
+    api->register_function(vm, "sqlite_buffer_copy", &sqlite_buffer_copy);
+    api->register_function(vm, "sqlite_buffer_size", &sqlite_buffer_size);
+    api->register_function(vm, "sqlite_buffer_read", &sqlite_buffer_read);
+    api->register_function(vm, "sqlite_buffer_free", &sqlite_buffer_free);
+    api->register_function(vm, "sqlite_next_row", &sqlite_next_row);
+    api->register_function(vm, "sqlite_fetch_many", &sqlite_fetch_many);
+    api->register_function(vm, "sqlite_reset", &sqlite_reset);
+    api->register_function(vm, "sqlite_clear_bindings", &sqlite_clear_bindings);
     api->register_function(vm, "sqlite_finalize", &sqlite_finalize);
+    api->register_function(vm, "sqlite_query", &sqlite_query);
+    api->register_function(vm, "sqlite_exec_many", &sqlite_exec_many);
+    api->register_function(vm, "sqlite_blob_open", &sqlite_blob_open);
+    api->register_function(vm, "sqlite_blob_bytes", &sqlite_blob_bytes);
+    api->register_function(vm, "sqlite_blob_read", &sqlite_blob_read);
+    api->register_function(vm, "sqlite_blob_write", &sqlite_blob_write);
+    api->register_function(vm, "sqlite_blob_reopen", &sqlite_blob_reopen);
+    api->register_function(vm, "sqlite_blob_close", &sqlite_blob_close);
+    api->register_function(vm, "sqlite_begin", &sqlite_begin);
+    api->register_function(vm, "sqlite_commit", &sqlite_commit);
+    api->register_function(vm, "sqlite_rollback", &sqlite_rollback);
+    api->register_function(vm, "sqlite_savepoint", &sqlite_savepoint);
+    api->register_function(vm, "sqlite_release", &sqlite_release);
+    api->register_function(vm, "sqlite_autobatch", &sqlite_autobatch);
+    api->register_function(vm, "sqlite_write_queue", &sqlite_write_queue);
+    api->register_function(vm, "sqlite_write_queue_stats", &sqlite_write_queue_stats);
+    api->register_function(vm, "sqlite_set_timeout", &sqlite_set_timeout);
+    api->register_function(vm, "sqlite_interrupt", &sqlite_interrupt);
+    api->register_function(vm, "sqlite_checkpointer_start", &sqlite_checkpointer_start);
+    api->register_function(vm, "sqlite_checkpointer_stop", &sqlite_checkpointer_stop);
+    api->register_function(vm, "sqlite_checkpointer_stats", &sqlite_checkpointer_stats);
+    api->register_function(vm, "sqlite_busy_timeout", &sqlite_busy_timeout);
+    api->register_function(vm, "sqlite_busy_backoff", &sqlite_busy_backoff);
+    api->register_function(vm, "sqlite_busy_retry", &sqlite_busy_retry);
+    api->register_function(vm, "sqlite_busy_stats", &sqlite_busy_stats);
+    api->register_function(vm, "sqlite_cache_capacity", &sqlite_cache_capacity);
+    api->register_function(vm, "sqlite_cache_stats", &sqlite_cache_stats);
+    api->register_function(vm, "sqlite_exec_async", &sqlite_exec_async);
+    api->register_function(vm, "sqlite_prepare_async", &sqlite_prepare_async);
+    api->register_function(vm, "sqlite_step_async", &sqlite_step_async);
+    api->register_function(vm, "sqlite_poll", &sqlite_poll);
+    api->register_function(vm, "sqlite_await", &sqlite_await);
+    api->register_function(vm, "sqlite_backup_start", &sqlite_backup_start);
+    api->register_function(vm, "sqlite_backup_step", &sqlite_backup_step);
+    api->register_function(vm, "sqlite_backup_progress", &sqlite_backup_progress);
+    api->register_function(vm, "sqlite_backup_background", &sqlite_backup_background);
+    api->register_function(vm, "sqlite_backup_finish", &sqlite_backup_finish);
+    api->register_function(vm, "sqlite_memory_stats", &sqlite_memory_stats);
+    api->register_function(vm, "sqlite_lookaside_stats", &sqlite_lookaside_stats);
+    api->register_function(vm, "sqlite_pcache_stats", &sqlite_pcache_stats);
+    api->register_function(vm, "sqlite_allocator_stats", &sqlite_allocator_stats);
     api->register_function(vm, "sqlite_free_string", &sqlite_free_string);
 }